@@ -6,38 +6,72 @@
 
 using namespace al;
 
+#include <atomic>
+#include <cstdint>
 #include <fstream>
 #include <vector>
 using namespace std;
 
-Vec3f randomVec3f(float scale) {
-  return Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS()) * scale;
-}
-float flockCentering = 1.2;
-float alignStrength = 0.4;
-float cubeAvoidance = 0.1;
-float goalTimer = 0;       // elapsed time since last update
-float goalInterval = 3.0f; // update every 5 seconds
+#include "flock.hpp"
+#include "instanced_mesh.hpp"
+#include "common/fixed_step_clock.hpp"
+#include "common/sim_thread.hpp"
+#include "common/snapshot.hpp"
+#include "common/thread_pool.hpp"
+#include "common/triple_buffer.hpp"
+
+int agentCount = 18;       // the spatial hash keeps 50k+ interactive
+double fixedStep = 1 / 60.0; // seconds per step in deterministic mode
 
 struct AlloApp : App {
   Parameter timeStep{"/timeStep", "", 0.1, 0.01, 0.6};
+  ParameterBool simThread{"/simThread", "", 0};  // flocking off the render thread
+  ParameterBool multithread{"/multithread", "", 1};  // same flock either way
+  ParameterBool instanced{"/instanced", "", 1};  // one draw call per mesh
+  ParameterBool deterministic{"/deterministic", "", 0};  // fixed steps from /seed
+  ParameterInt seed{"/seed", "", 1, 0, 1000000};
   Light light;
   Material material;  // Necessary for specular highlights
   Mesh cone;
   Mesh cube;
+  ShaderProgram instanceShader;
+  InstancedMesh coneInstances, cubeInstances;
+  std::vector<Vec4f> instanceOffset, instanceRotation; // upload staging
+
+  // the agents and the rules (flock.hpp; boids_bench runs the same code).
+  // orientation is not stored at all, onDraw turns each cone to face along
+  // its velocity
+  Flock flock;
+  ThreadPool pool;
 
-  // size, color, species, sex, age, etc.
-  std::vector<Nav> agent;
-  std::vector<float> size; // (0, 1]
-  std::vector<int> interest; // (0, 1]
-  std::vector<Vec3f> cubePos;
-  std::vector<Vec3f> velocity;
-  std::vector<Vec3f> target;
+  // with /simThread on, the flock is stepped on `sim` and onDraw only sees
+  // the state it publishes through `frames`
+  struct Frame {
+    std::vector<Vec3f> position;
+    std::vector<Vec3f> velocity;
+    std::vector<float> size;
+  };
+  TripleBuffer<Frame> frames;
+  SimThread sim;
+
+  // in deterministic mode the flock advances in steps of fixedStep, however
+  // long the frames are, so a run from one seed (or one snapshot) always
+  // plays out the same way
+  FixedStepClock clock;
+  std::vector<char> snapshot;
+  string snapshotFile = "flock.snapshot";
+  atomic<bool> snapshotRequested{false}, restoreRequested{false},
+      restartRequested{false};
 
   void onInit() override {
     auto GUIdomain = GUIDomain::enableGUI(defaultWindowDomain());
     auto &gui = GUIdomain->newGUI();
     gui.add(timeStep);
+    gui.add(simThread);
+    gui.add(multithread);
+    gui.add(instanced);
+    gui.add(deterministic);
+    gui.add(seed);
   }
 
   void onCreate() override {
@@ -51,19 +85,7 @@ struct AlloApp : App {
     cone.generateNormals();
     light.pos(0, 10, 10);
 
-    for (int i = 0; i < 18; ++i) {
-      Nav p;
-      p.pos() = randomVec3f(5);
-      p.quat()
-          .set(rnd::uniformS(), rnd::uniformS(), rnd::uniformS(),
-               rnd::uniformS())
-          .normalize();
-      velocity.push_back(Vec3f(0)); // 初始速度为0
-      target.push_back(randomVec3f(5)); // 给每个agent一个初始目标
-      agent.push_back(p);
-      size.push_back(rnd::uniform(0.05, 1.0));
-      interest.push_back(-1);
-    }
+    restart(deterministic ? seed.get() : (uint64_t)(rnd::uniform() * 4294967296.0));
 
     //we make obstacles here 
     addCube(cube);
@@ -76,105 +98,157 @@ struct AlloApp : App {
       for (int y = 0; y < 3; ++y) {
         for (int z = 0; z < 3; ++z) {
           Vec3f pos = Vec3f(x * spacing, y * spacing, z * spacing) + centerOffset;
-          cubePos.push_back(pos);
+          flock.cubePos.push_back(pos);
         }
       }
     }
 
+    instanceShader.compile(InstancedMesh::vertexShader(),
+                           InstancedMesh::fragmentShader());
+    coneInstances.init(cone);
+    cubeInstances.init(cube);
+
   }
   // Translate the cube to that position
 
+  // a new flock drawn from the given seed
+  void restart(uint64_t s) {
+    flock.restart(agentCount, s);
+    clock.accumulator = 0;
+  }
+
   void onAnimate(double dt) override {
-    goalTimer += dt;
-  if (goalTimer > goalInterval) {
-  goalTimer = 0;
+    if (simThread && !sim.running())
+      // agents move a fixed distance per step, so keep the frame rate's pace
+      sim.start([this](double dt) { simulate(dt, true); }, 60);
+    if (!simThread && sim.running()) sim.stop();
+    if (!sim.running()) simulate(dt, false);
+  }
+
+  // runs on the render thread or on `sim`, never both at once
+  void simulate(double dt, bool publish) {
+    handleRequests();
+    if (deterministic) {
+      int steps = clock.advance(dt, fixedStep, 4);
+      for (int s = 0; s < steps; ++s) flock.step(fixedStep, multithread ? &pool : nullptr);
+    } else {
+      flock.step(dt, multithread ? &pool : nullptr);
+    }
 
-  // assign each agent a new target
-  for (int i = 0; i < target.size(); ++i) {
-    target[i] = randomVec3f(8); // or larger like randomVec3f(10)
+    if (publish) {
+      Frame &frame = frames.writeBuffer();
+      frame.position = flock.position;
+      frame.velocity = flock.velocity;
+      frame.size = flock.size;
+      frames.publish();
+    }
   }
-}
 
-    for (int i = 0; i < agent.size(); ++i) {
-      Vec3f pos = agent[i].pos();
-      Vec3f dir(0);
-  
-      // ---------- Wander (seek random target) ----------
-      Vec3f seek = target[i] - pos;
-      float dist = seek.mag();
-      if (dist < 0.1) {
-        target[i] = randomVec3f(5);
+  void handleRequests() {
+    if (restartRequested.exchange(false)) restart(seed.get());
+
+    if (snapshotRequested.exchange(false)) {
+      SnapshotWriter out(snapshot);
+      flock.save(out);
+      out.put(clock.accumulator);
+      saveSnapshot(snapshotFile, snapshot);
+      printf("snapshot of step %lld, %d bytes\n", flock.stepCount, (int)snapshot.size());
+    }
+
+    if (restoreRequested.exchange(false)) {
+      if (snapshot.empty()) loadSnapshot(snapshotFile, snapshot);
+      // nothing changes unless the whole snapshot reads back
+      SnapshotReader in(snapshot);
+      Flock::Saved saved;
+      double accumulator = 0;
+      Flock::read(in, saved);
+      in.get(accumulator);
+      if (in.ok) {
+        flock.restore(saved);
+        clock.accumulator = accumulator;
+        printf("back at step %lld\n", flock.stepCount);
       } else {
-        seek.normalize();
-        dir += seek;
-      }
-  
-      // ---------- Flock Centering ----------
-      Vec3f center(0);
-      Vec3f align(0);
-      Vec3f repel(0); // agent-agent avoidance
-      int neighborCount = 0;
-  
-      for (int j = 0; j < agent.size(); ++j) {
-        if (i == j) continue;
-        Vec3f diff = agent[j].pos() - pos;
-        float d = diff.mag();
-  
-        // Flock only if not too close
-        if (d > 1.0 && d < 4.0) {
-          center += agent[j].pos();
-          align += velocity[j];
-          neighborCount++;
-        }
-  
-        // Repel if too close
-        if (d < 1.0 && d > 0.001) {
-          repel -= diff.normalize() / d; // repel direction: away
-        }
-      }
-  
-      if (neighborCount > 0) {
-        center /= neighborCount;
-        Vec3f centerDir = (center - pos).normalize();
-        Vec3f alignDir = (align / neighborCount).normalize();
-        dir += centerDir * flockCentering;
-        dir += alignDir * alignStrength;
-      }
-  
-      // Add agent-agent avoidance
-      if (repel.mag() > 0.001) {
-        repel.normalize();
-        dir += repel * cubeAvoidance;
-      }
-  
-      // ---------- Cube Avoidance ----------
-      Vec3f cubeRepel(0);
-      for (int c = 0; c < cubePos.size(); ++c) {
-        Vec3f diff = pos - cubePos[c];
-        float d = diff.mag();
-        if (d < 1.5 && d > 0.001) {
-          cubeRepel += diff.normalize() / d;
-        }
-      }
-      if (cubeRepel.mag() > 0.001) {
-        cubeRepel.normalize();
-        dir += cubeRepel * cubeAvoidance;
-      }
-  
-      // ---------- Final Move ----------
-      if (dir.mag() > 0.001) {
-        dir.normalize();
-        velocity[i] = dir * 0.05;
-        pos += velocity[i];
-        agent[i].pos() = pos;
-        agent[i].faceToward(pos + velocity[i]);
+        printf("no usable snapshot in %s\n", snapshotFile.c_str());
       }
     }
   }
 
+  bool onKeyDown(const Keyboard &k) override {
+    if (k.key() == '1') snapshotRequested = true;
+    if (k.key() == '2') restoreRequested = true;
+    if (k.key() == '0') restartRequested = true;  // same seed, same flock
+    return true;
+  }
+
+  void onExit() override { sim.stop(); }
+
+  void drawAgents(Graphics &g, const std::vector<Vec3f> &position,
+                  const std::vector<Vec3f> &velocity,
+                  const std::vector<float> &size) {
+    for (int i = 0; i < position.size(); ++i) {
+      g.pushMatrix();
+      g.translate(position[i]);
+      g.rotate(heading(velocity[i]));
+      g.scale(size[i]);
+      g.draw(cone);
+      g.popMatrix();
+    }
+  }
+
+  // the same scene in two draw calls. lighting matches the light and
+  // material set up below for the per-object path
+  void drawInstanced(Graphics &g) {
+    g.shader(instanceShader);
+    g.shader().uniform("lightPosition", Vec3f(0, 10, 10));
+    g.shader().uniform("eyePosition", Vec3f(nav().pos()));
+    g.shader().uniform("lightColor", Vec3f(1, 1, 0.5));
+    g.shader().uniform("ambient", 0.1f);
+    g.shader().uniform("specular", 0.2f);
+    g.shader().uniform("shininess", 50.0f);
+
+    // with the sim thread running, everything about the agents comes from
+    // the published frame; the flock itself may be mid-restart
+    const std::vector<Vec3f> *p = &flock.position, *v = &flock.velocity;
+    const std::vector<float> *size = &flock.size;
+    if (sim.running()) {
+      frames.update();
+      p = &frames.readBuffer().position;
+      v = &frames.readBuffer().velocity;
+      size = &frames.readBuffer().size;
+    }
+    instanceOffset.resize(p->size());
+    instanceRotation.resize(p->size());
+    for (int i = 0; i < p->size(); ++i) {
+      Quatd q = heading((*v)[i]);
+      instanceOffset[i] = Vec4f((*p)[i].x, (*p)[i].y, (*p)[i].z, (*size)[i]);
+      instanceRotation[i] = Vec4f(q.x, q.y, q.z, q.w);
+    }
+    coneInstances.set(instanceOffset, instanceRotation);
+    coneInstances.draw(g);
+
+    const std::vector<Vec3f> &cubePos = flock.cubePos;
+    instanceOffset.resize(cubePos.size());
+    instanceRotation.assign(cubePos.size(), Vec4f(0, 0, 0, 1));
+    for (int i = 0; i < cubePos.size(); ++i)
+      instanceOffset[i] = Vec4f(cubePos[i].x, cubePos[i].y, cubePos[i].z, 1);
+    cubeInstances.set(instanceOffset, instanceRotation);
+    cubeInstances.draw(g);
+  }
+
+  // what faceToward(pos + velocity) used to store: the turn from forward
+  // (-z) to the direction of travel
+  static Quatd heading(const Vec3f &velocity) {
+    if (velocity.mag() < 1e-6) return Quatd();
+    return Quatd::getRotationTo(Vec3d(0, 0, -1), Vec3d(velocity).normalize());
+  }
+
   void onDraw(Graphics &g) override {
     g.clear(0.27);
     g.depthTesting(true);
+    if (instanced) {
+      drawInstanced(g);
+      return;
+    }
     g.lighting(true);
     light.globalAmbient(RGB(0.1));
     light.ambient(RGB(0));
@@ -184,19 +258,18 @@ struct AlloApp : App {
     material.shininess(50);
     g.material(material);
   
-      for (int i = 0; i < agent.size(); ++i) {
-        g.pushMatrix();
-        g.translate(agent[i].pos());
-        g.rotate(agent[i].quat());
-        g.scale(size[i]);
-        g.draw(cone);
-        g.popMatrix();
+    if (sim.running()) {
+      frames.update();
+      const Frame &frame = frames.readBuffer();
+      drawAgents(g, frame.position, frame.velocity, frame.size);
+    } else {
+      drawAgents(g, flock.position, flock.velocity, flock.size);
     }
 
     // Draw cube
-    for (int i = 0; i < cubePos.size(); i++) {
+    for (int i = 0; i < flock.cubePos.size(); i++) {
       g.pushMatrix();
-      g.translate(cubePos[i]);
+      g.translate(flock.cubePos[i]);
       g.draw(cube);
       g.popMatrix();
   }
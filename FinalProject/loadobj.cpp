@@ -6,6 +6,7 @@
 #include <cstdint>
 #include <vector>
 #include <iostream>
+#include "../common/asset_loader.hpp"
 
 using namespace al;
 using namespace std;
@@ -17,6 +18,7 @@ struct MyApp : App {
     float scale = 1.0f;
     bool modelLoaded = false;
     Mesh errorMesh;  // Mesh for error state
+    AssetLoader assets;  // imports the OBJ off the render thread
 
     void onCreate() override {
         // Set up camera
@@ -26,9 +28,13 @@ struct MyApp : App {
         // Create error mesh (sphere)
         addSphere(errorMesh, 0.5);
 
-        // Load the OBJ file
+        // Load the OBJ file in the background; the error sphere shows meanwhile
         std::string fileName = "../Moon2K.obj";
-        ascene = Scene::import(fileName);
+        assets.async([this, fileName] { ascene = Scene::import(fileName); },
+                     [this, fileName] { onModelLoaded(fileName); });
+    }
+
+    void onModelLoaded(const std::string& fileName) {
         if (!ascene) {
             std::cerr << "Error loading OBJ: " << fileName << std::endl;
             return;
@@ -63,6 +69,7 @@ struct MyApp : App {
     }
 
     void onAnimate(double dt) override {
+        assets.poll();
         rotationAngle += dt * 0.5;  // Rotate 0.5 radians per second
     }
 
@@ -10,6 +10,8 @@ using namespace al;
 #include <vector>
 using namespace std;
 
+#include "spatial_hash.hpp"
+
 Vec3f randomVec3f(float scale) {
   return Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS()) * scale;
 }
@@ -18,6 +20,8 @@ float alignStrength = 0.4;
 float cubeAvoidance = 0.1;
 float goalTimer = 0;       // elapsed time since last update
 float goalInterval = 3.0f; // update every 5 seconds
+float flockRadius = 4.0;   // neighbors further away are ignored
+int agentCount = 18;       // the spatial hash keeps 50k+ interactive
 
 struct AlloApp : App {
   Parameter timeStep{"/timeStep", "", 0.1, 0.01, 0.6};
@@ -33,6 +37,8 @@ struct AlloApp : App {
   std::vector<Vec3f> cubePos;
   std::vector<Vec3f> velocity;
   std::vector<Vec3f> target;
+  std::vector<Vec3f> position; // start of step, what `grid` is built on
+  SpatialHash grid;
 
   void onInit() override {
     auto GUIdomain = GUIDomain::enableGUI(defaultWindowDomain());
@@ -51,7 +57,7 @@ struct AlloApp : App {
     cone.generateNormals();
     light.pos(0, 10, 10);
 
-    for (int i = 0; i < 18; ++i) {
+    for (int i = 0; i < agentCount; ++i) {
       Nav p;
       p.pos() = randomVec3f(5);
       p.quat()
@@ -95,6 +101,11 @@ struct AlloApp : App {
   }
 }
 
+    // only agents in nearby cells can be within flockRadius
+    position.resize(agent.size());
+    for (int i = 0; i < agent.size(); ++i) position[i] = agent[i].pos();
+    grid.build(position, flockRadius);
+
     for (int i = 0; i < agent.size(); ++i) {
       Vec3f pos = agent[i].pos();
       Vec3f dir(0);
@@ -115,13 +126,13 @@ struct AlloApp : App {
       Vec3f repel(0); // agent-agent avoidance
       int neighborCount = 0;
   
-      for (int j = 0; j < agent.size(); ++j) {
-        if (i == j) continue;
+      grid.forEachNear(pos, [&](int j) {
+        if (i == j) return;
         Vec3f diff = agent[j].pos() - pos;
         float d = diff.mag();
   
         // Flock only if not too close
-        if (d > 1.0 && d < 4.0) {
+        if (d > 1.0 && d < flockRadius) {
           center += agent[j].pos();
           align += velocity[j];
           neighborCount++;
@@ -131,7 +142,7 @@ struct AlloApp : App {
         if (d < 1.0 && d > 0.001) {
           repel -= diff.normalize() / d; // repel direction: away
         }
-      }
+      });
   
       if (neighborCount > 0) {
         center /= neighborCount;
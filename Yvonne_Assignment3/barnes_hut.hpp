@@ -0,0 +1,245 @@
+// Barnes-Hut octree for the Coulomb repulsion in particle.cpp
+//
+// The exact pass visits every pair, O(n*n). Here the particles are sorted
+// into an octree that is rebuilt every step; a far-away cell is treated as one
+// big charge sitting at its center of charge, so each particle only visits
+// O(log n) cells. theta trades accuracy for speed: 0 is exact, ~0.5 is the
+// usual choice, 1.0 is fast and rough.
+//
+// All particles carry the same charge (chargeK), so a cell's "mass" is just
+// how many particles are in it.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+#include "al/math/al_Vec.hpp"
+
+#include "../common/thread_pool.hpp"
+
+struct BarnesHut {
+  struct Node {
+    al::Vec3f center;  // geometric center of the cube
+    float halfSize;
+    al::Vec3f com;     // center of charge
+    float open;        // a particle closer than this to com must open the cell
+    int count;         // particles in this cell
+    int begin, end;    // range in `order`
+    int firstChild;    // children are contiguous; -1 for a leaf
+    int childCount;
+  };
+
+  float theta = 0.5f;
+  int leafSize = 8;  // stop splitting at this many particles
+  int maxDepth = 20;  // stop splitting coincident points
+
+  std::vector<Node> nodes;
+  std::vector<int> order;    // particle indices, grouped by cell
+  std::vector<int> scratch;  // partition buffer
+
+  // cells + particles that exerted a force in the last accumulate()
+  long long interactions = 0;
+
+  // rebuild the tree around the current positions
+  void build(const std::vector<al::Vec3f>& position) {
+    int n = position.size();
+    nodes.clear();
+    order.resize(n);
+    scratch.resize(n);
+    if (n == 0) return;
+    for (int i = 0; i < n; ++i) order[i] = i;
+
+    al::Vec3f lo = position[0], hi = position[0];
+    for (auto& p : position)
+      for (int k = 0; k < 3; ++k) {
+        lo[k] = std::min(lo[k], p[k]);
+        hi[k] = std::max(hi[k], p[k]);
+      }
+    float halfSize = 0.5f * std::max({hi.x - lo.x, hi.y - lo.y, hi.z - lo.z});
+
+    nodes.reserve(2 * n / leafSize + 1);
+    nodes.push_back(makeNode((lo + hi) * 0.5f, halfSize * 1.0001f + 1e-6f, 0, n));
+    split(position, 0, 0);
+  }
+
+  // force[i] += repulsion on i from every other particle, using the tree from
+  // the last build(). same kernel as the exact loop: chargeK / (r^2 + epsilon)
+  void accumulate(const std::vector<al::Vec3f>& position,
+                  std::vector<al::Vec3f>& force, float chargeK,
+                  float epsilon) {
+    long long count = 0;
+    for (int i = 0; i < (int)position.size(); ++i)
+      force[i] += forceOn(position, i, chargeK, epsilon, &count);
+    interactions = count;
+  }
+
+  // same, one slice of particles per thread. every particle walks the tree
+  // on its own and only writes its own force, so there is nothing to merge
+  void accumulate(ThreadPool& pool, const std::vector<al::Vec3f>& position,
+                  std::vector<al::Vec3f>& force, float chargeK,
+                  float epsilon) {
+    std::atomic<long long> total{0};
+    pool.parallelFor(position.size(), [&](int begin, int end) {
+      long long count = 0;
+      for (int i = begin; i < end; ++i)
+        force[i] += forceOn(position, i, chargeK, epsilon, &count);
+      total += count;
+    });
+    interactions = total;
+  }
+
+  al::Vec3f forceOn(const std::vector<al::Vec3f>& position, int i,
+                    float chargeK, float epsilon,
+                    long long* interactions = nullptr) const {
+    al::Vec3f f(0);
+    if (nodes.empty()) return f;
+    int count = 0;
+    const al::Vec3f& p = position[i];
+
+    int stack[64 * 8];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+      const Node& node = nodes[stack[--top]];
+      al::Vec3f dir = p - node.com;
+      float distSqr = dir.magSqr();
+
+      if (distSqr > node.open * node.open) {
+        // far enough: the whole cell acts like one charge
+        float dist = std::sqrt(distSqr);
+        f += dir * (chargeK * node.count / ((distSqr + epsilon) * dist));
+        count++;
+      } else if (node.firstChild < 0) {
+        // near leaf: exact pairs
+        for (int k = node.begin; k < node.end; ++k) {
+          int j = order[k];
+          if (j == i) continue;
+          al::Vec3f d = p - position[j];
+          float r2 = d.magSqr();
+          if (r2 <= 0) continue;
+          f += d * (chargeK / ((r2 + epsilon) * std::sqrt(r2)));
+        }
+        count += node.end - node.begin;
+      } else {
+        for (int c = 0; c < node.childCount; ++c)
+          stack[top++] = node.firstChild + c;
+      }
+    }
+    if (interactions) *interactions += count;
+    return f;
+  }
+
+ private:
+  Node makeNode(al::Vec3f center, float halfSize, int begin, int end) {
+    Node node;
+    node.center = center;
+    node.halfSize = halfSize;
+    node.com = center;
+    node.open = 0;
+    node.count = end - begin;
+    node.begin = begin;
+    node.end = end;
+    node.firstChild = -1;
+    node.childCount = 0;
+    return node;
+  }
+
+  // `nodes` grows while we recurse, so only hold indices, never references
+  void split(const std::vector<al::Vec3f>& position, int index, int depth) {
+    int begin = nodes[index].begin, end = nodes[index].end;
+    al::Vec3f center = nodes[index].center;
+    float halfSize = nodes[index].halfSize;
+
+    if (end - begin > leafSize && depth < maxDepth) {
+      // counting sort the range into octants
+      int bucket[9] = {0};
+      auto octant = [&](int i) {
+        const al::Vec3f& p = position[i];
+        return (p.x > center.x) | ((p.y > center.y) << 1) |
+               ((p.z > center.z) << 2);
+      };
+      for (int k = begin; k < end; ++k) bucket[octant(order[k]) + 1]++;
+      for (int o = 0; o < 8; ++o) bucket[o + 1] += bucket[o];
+      int cursor[8];
+      for (int o = 0; o < 8; ++o) cursor[o] = begin + bucket[o];
+      for (int k = begin; k < end; ++k) scratch[cursor[octant(order[k])]++] = order[k];
+      std::copy(scratch.begin() + begin, scratch.begin() + end, order.begin() + begin);
+
+      int first = nodes.size();
+      float h = halfSize * 0.5f;
+      for (int o = 0; o < 8; ++o) {
+        int b = begin + bucket[o], e = begin + bucket[o + 1];
+        if (b == e) continue;
+        al::Vec3f c = center + al::Vec3f((o & 1) ? h : -h, (o & 2) ? h : -h,
+                                         (o & 4) ? h : -h);
+        nodes.push_back(makeNode(c, h, b, e));
+      }
+      int last = nodes.size();
+      nodes[index].firstChild = first;
+      nodes[index].childCount = last - first;
+      for (int c = first; c < last; ++c) split(position, c, depth + 1);
+    }
+
+    // center of charge: from children if we have them, else from particles
+    al::Vec3f com(0);
+    Node& node = nodes[index];
+    if (node.firstChild >= 0) {
+      for (int c = 0; c < node.childCount; ++c) {
+        const Node& child = nodes[node.firstChild + c];
+        com += child.com * (float)child.count;
+      }
+    } else {
+      for (int k = begin; k < end; ++k) com += position[order[k]];
+    }
+    node.com = com / (float)node.count;
+
+    // opening distance: size / theta, pushed out by how far the center of
+    // charge sits from the middle of the cell so a particle inside the cell
+    // can never treat it as far away (theta up to 1)
+    float theta_ = std::max(theta, 1e-6f);
+    node.open = 2 * node.halfSize / theta_ + (node.com - node.center).mag();
+  }
+};
+
+// exact O(n*n) pass, same kernel. used to measure the tree's error
+inline void coulombExact(const std::vector<al::Vec3f>& position,
+                         std::vector<al::Vec3f>& force, float chargeK,
+                         float epsilon) {
+  for (int i = 0; i < (int)position.size(); ++i) {
+    for (int j = i + 1; j < (int)position.size(); ++j) {
+      al::Vec3f dir = position[i] - position[j];
+      float distSqr = dir.magSqr() + epsilon;
+      float strength = chargeK / distSqr;
+      al::Vec3f repulsion = dir.normalize(strength);
+      force[i] += repulsion;
+      force[j] -= repulsion;
+    }
+  }
+}
+
+// RMS of |approx - exact| / |exact| over `samples` particles spread through
+// the set. costs O(n * samples), so it is fine to call every now and then
+inline float coulombError(const std::vector<al::Vec3f>& position,
+                          const BarnesHut& tree, float chargeK, float epsilon,
+                          int samples = 64) {
+  int n = position.size();
+  if (n < 2) return 0;
+  samples = std::min(samples, n);
+  double sum = 0;
+  for (int s = 0; s < samples; ++s) {
+    int i = (long long)s * n / samples;
+    al::Vec3f exact(0);
+    for (int j = 0; j < n; ++j) {
+      if (j == i) continue;
+      al::Vec3f dir = position[i] - position[j];
+      exact += dir.normalize(chargeK / (dir.magSqr() + epsilon));
+    }
+    al::Vec3f approx = tree.forceOn(position, i, chargeK, epsilon);
+    float m = exact.mag();
+    if (m > 0) sum += (approx - exact).magSqr() / (m * m);
+  }
+  return std::sqrt(sum / samples);
+}
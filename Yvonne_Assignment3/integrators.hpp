@@ -0,0 +1,112 @@
+// Fixed-step clock and integrators for the particle sims
+//
+// FixedStepClock (in common/, the boids use it too) turns the frame's dt
+// into a whole number of fixed steps.
+//
+// Integrator advances position/velocity by one step of size h. It does not
+// know about springs or charges: evaluate() has to fill `force` from whatever
+// is in position/velocity right now (clear first, then add). How often it is
+// called depends on the scheme:
+//   semi-implicit Euler  1 per step, first order
+//   velocity Verlet      1 per step (forces carry over), second order
+//   RK4                  4 per step, fourth order
+// updateMs is what the step costs apart from those calls: the scheme's own
+// position and velocity updates (for RK4 also its copies and sums).
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include "al/math/al_Vec.hpp"
+
+#include "../common/fixed_step_clock.hpp"
+
+struct Integrator {
+  enum Scheme { SEMI_IMPLICIT_EULER, VELOCITY_VERLET, RK4 };
+
+  int evaluations = 0;  // calls to evaluate() in the last step
+  double updateMs = 0;  // per step outside evaluate(), smoothed over ~30 steps
+
+  // call when the state was changed behind the integrator's back, so Verlet
+  // does not reuse forces from before the change
+  void invalidate() { haveForces = false; }
+
+  void step(int scheme, float h, std::vector<al::Vec3f>& position,
+            std::vector<al::Vec3f>& velocity, std::vector<al::Vec3f>& force,
+            const std::vector<float>& mass,
+            const std::function<void()>& evaluate) {
+    typedef std::chrono::steady_clock Clock;
+    auto since = [](Clock::time_point t) {
+      return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+    };
+    auto start = Clock::now();
+    double evaluateMs = 0;
+    evaluations = 0;
+    auto eval = [&] {
+      auto t = Clock::now();
+      evaluate();
+      evaluateMs += since(t);
+      evaluations++;
+    };
+    int n = position.size();
+    if (scheme != lastScheme) haveForces = false;
+    lastScheme = scheme;
+
+    if (scheme == VELOCITY_VERLET) {
+      // kick-drift-kick. drag sees the half-step velocity
+      if (!haveForces) eval();
+      for (int i = 0; i < n; ++i) {
+        velocity[i] += force[i] / mass[i] * (0.5f * h);
+        position[i] += velocity[i] * h;
+      }
+      eval();
+      for (int i = 0; i < n; ++i) velocity[i] += force[i] / mass[i] * (0.5f * h);
+      haveForces = true;
+    } else if (scheme == RK4) {
+      x0 = position;
+      v0 = velocity;
+      sumX.assign(n, al::Vec3f(0));
+      sumV.assign(n, al::Vec3f(0));
+      // k1..k4, each evaluated where the previous one points
+      const float along[4] = {0, 0.5f, 0.5f, 1};
+      const float weight[4] = {1, 2, 2, 1};
+      for (int k = 0; k < 4; ++k) {
+        if (k > 0) {
+          for (int i = 0; i < n; ++i) {
+            // position/velocity still hold the last k's derivative input
+            al::Vec3f dx = velocity[i], dv = force[i] / mass[i];
+            position[i] = x0[i] + dx * (along[k] * h);
+            velocity[i] = v0[i] + dv * (along[k] * h);
+          }
+        }
+        eval();
+        for (int i = 0; i < n; ++i) {
+          sumX[i] += velocity[i] * weight[k];
+          sumV[i] += force[i] / mass[i] * weight[k];
+        }
+      }
+      for (int i = 0; i < n; ++i) {
+        position[i] = x0[i] + sumX[i] * (h / 6);
+        velocity[i] = v0[i] + sumV[i] * (h / 6);
+      }
+      haveForces = false;
+    } else {
+      // "semi-implicit" Euler integration
+      eval();
+      for (int i = 0; i < n; ++i) {
+        velocity[i] += force[i] / mass[i] * h;
+        position[i] += velocity[i] * h;
+      }
+      haveForces = false;
+    }
+    updateMs += (since(start) - evaluateMs - updateMs) / 30;
+  }
+
+ private:
+  int lastScheme = -1;
+  bool haveForces = false;
+  std::vector<al::Vec3f> x0, v0, sumX, sumV;  // RK4 scratch
+};
@@ -0,0 +1,288 @@
+// Exact all-pairs Coulomb kernel over SoA float arrays
+//
+// Same force as the scalar loop in particle.cpp (chargeK / (r^2 + epsilon)
+// along the line between the two particles) but:
+//  - positions and forces live in separate x/y/z float arrays, so 8 or 16
+//    particles load with one instruction
+//  - the j loop is cut into tiles that fit in L1 together with their forces
+//  - 1/r comes from rsqrt plus one Newton step and 1/(r^2 + epsilon) from rcp
+//    plus one Newton step, instead of a sqrt and a divide per pair
+// Each pair is still visited once: particle i accumulates in registers and
+// the opposite force is subtracted from a contiguous run of j, so there are
+// no scatter conflicts inside a vector.
+//
+// The AVX-512 / AVX2 versions are compiled with target attributes and picked
+// at runtime from what the CPU supports, so no -march flag is needed. Other
+// compilers and CPUs get the plain loop, which they are free to vectorize.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "al/math/al_Vec.hpp"
+
+#include "../common/thread_pool.hpp"
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define PAIR_KERNEL_X86 1
+#include <immintrin.h>
+#endif
+
+struct ParticleSoA {
+  std::vector<float> x, y, z;
+  std::vector<float> fx, fy, fz;
+
+  int size() const { return x.size(); }
+
+  // copy positions in and zero the force accumulators
+  void load(const std::vector<al::Vec3f>& position) {
+    int n = position.size();
+    x.resize(n), y.resize(n), z.resize(n);
+    fx.assign(n, 0), fy.assign(n, 0), fz.assign(n, 0);
+    for (int i = 0; i < n; ++i) {
+      x[i] = position[i].x;
+      y[i] = position[i].y;
+      z[i] = position[i].z;
+    }
+  }
+
+  void addForcesTo(std::vector<al::Vec3f>& force) const {
+    for (int i = 0; i < size(); ++i) force[i] += al::Vec3f(fx[i], fy[i], fz[i]);
+  }
+};
+
+namespace pair_kernel {
+
+// one particle i against particles [j0, j1). forces go to fx/fy/fz, which
+// may be s.fx/fy/fz or a per-thread buffer of the same length
+inline void rowScalar(const ParticleSoA& s, float* fx, float* fy, float* fz,
+                      int i, int j0, int j1, float chargeK, float epsilon) {
+  float xi = s.x[i], yi = s.y[i], zi = s.z[i];
+  float ax = 0, ay = 0, az = 0;
+  for (int j = j0; j < j1; ++j) {
+    float dx = xi - s.x[j], dy = yi - s.y[j], dz = zi - s.z[j];
+    float r2 = dx * dx + dy * dy + dz * dz;
+    float k = r2 > 0 ? chargeK / ((r2 + epsilon) * std::sqrt(r2)) : 0;
+    dx *= k, dy *= k, dz *= k;
+    ax += dx, ay += dy, az += dz;
+    fx[j] -= dx, fy[j] -= dy, fz[j] -= dz;
+  }
+  fx[i] += ax, fy[i] += ay, fz[i] += az;
+}
+
+#ifdef PAIR_KERNEL_X86
+
+// the eight lanes of v added onto out, in lane order
+__attribute__((target("avx2,fma"))) inline void addLanes(__m256 v, float& out) {
+  alignas(32) float lane[8];
+  _mm256_store_ps(lane, v);
+  for (int l = 0; l < 8; ++l) out += lane[l];
+}
+
+__attribute__((target("avx2,fma"))) inline void rowAVX2(
+    const ParticleSoA& s, float* fx, float* fy, float* fz, int i, int j0,
+    int j1, float chargeK, float epsilon) {
+  // scalar up to a multiple of 8 from j0, vector body, scalar tail
+  int body = j0 + (j1 - j0) / 8 * 8;
+  float xi = s.x[i], yi = s.y[i], zi = s.z[i];
+  __m256 vxi = _mm256_set1_ps(xi), vyi = _mm256_set1_ps(yi),
+         vzi = _mm256_set1_ps(zi);
+  __m256 vk = _mm256_set1_ps(chargeK), veps = _mm256_set1_ps(epsilon);
+  __m256 half = _mm256_set1_ps(0.5f), three = _mm256_set1_ps(3.0f),
+         two = _mm256_set1_ps(2.0f), zero = _mm256_setzero_ps();
+  __m256 ax = zero, ay = zero, az = zero;
+
+  for (int j = j0; j < body; j += 8) {
+    __m256 dx = _mm256_sub_ps(vxi, _mm256_loadu_ps(&s.x[j]));
+    __m256 dy = _mm256_sub_ps(vyi, _mm256_loadu_ps(&s.y[j]));
+    __m256 dz = _mm256_sub_ps(vzi, _mm256_loadu_ps(&s.z[j]));
+    __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+
+    // 1/r: y = y * (3 - r2 y^2) / 2
+    __m256 inv = _mm256_rsqrt_ps(r2);
+    inv = _mm256_mul_ps(_mm256_mul_ps(half, inv),
+                        _mm256_fnmadd_ps(_mm256_mul_ps(r2, inv), inv, three));
+    // 1/(r2 + epsilon): y = y * (2 - d y)
+    __m256 d = _mm256_add_ps(r2, veps);
+    __m256 rcp = _mm256_rcp_ps(d);
+    rcp = _mm256_mul_ps(rcp, _mm256_fnmadd_ps(d, rcp, two));
+
+    __m256 k = _mm256_mul_ps(vk, _mm256_mul_ps(inv, rcp));
+    k = _mm256_and_ps(k, _mm256_cmp_ps(r2, zero, _CMP_GT_OQ));  // self / coincident
+    dx = _mm256_mul_ps(dx, k), dy = _mm256_mul_ps(dy, k), dz = _mm256_mul_ps(dz, k);
+
+    ax = _mm256_add_ps(ax, dx), ay = _mm256_add_ps(ay, dy), az = _mm256_add_ps(az, dz);
+    _mm256_storeu_ps(fx + j, _mm256_sub_ps(_mm256_loadu_ps(fx + j), dx));
+    _mm256_storeu_ps(fy + j, _mm256_sub_ps(_mm256_loadu_ps(fy + j), dy));
+    _mm256_storeu_ps(fz + j, _mm256_sub_ps(_mm256_loadu_ps(fz + j), dz));
+  }
+
+  addLanes(ax, fx[i]), addLanes(ay, fy[i]), addLanes(az, fz[i]);
+  rowScalar(s, fx, fy, fz, i, body, j1, chargeK, epsilon);
+}
+
+// gcc 12's avx512fintrin.h builds _mm512_reduce_add_ps, rcp14, rsqrt14 and
+// the extracts on an uninitialized "undefined" vector, which -Wall reports.
+// The zero-masked forms with every lane selected are the same instructions
+// without that, so they are used throughout rowAVX512.
+static const __mmask16 allLanes = 0xffff;
+
+// the two 256-bit halves of v added, for addLanes. (through the pd
+// extract, as extractf32x8 needs AVX512DQ)
+__attribute__((target("avx512f"))) inline __m256 halves(__m512 v) {
+  __m512d d = _mm512_castps_pd(v);
+  return _mm256_add_ps(_mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xff, d, 0)),
+                       _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xff, d, 1)));
+}
+
+__attribute__((target("avx512f"))) inline void rowAVX512(
+    const ParticleSoA& s, float* fx, float* fy, float* fz, int i, int j0,
+    int j1, float chargeK, float epsilon) {
+  int body = j0 + (j1 - j0) / 16 * 16;
+  __m512 vxi = _mm512_set1_ps(s.x[i]), vyi = _mm512_set1_ps(s.y[i]),
+         vzi = _mm512_set1_ps(s.z[i]);
+  __m512 vk = _mm512_set1_ps(chargeK), veps = _mm512_set1_ps(epsilon);
+  __m512 half = _mm512_set1_ps(0.5f), three = _mm512_set1_ps(3.0f),
+         two = _mm512_set1_ps(2.0f), zero = _mm512_setzero_ps();
+  __m512 ax = zero, ay = zero, az = zero;
+
+  for (int j = j0; j < body; j += 16) {
+    __m512 dx = _mm512_sub_ps(vxi, _mm512_loadu_ps(&s.x[j]));
+    __m512 dy = _mm512_sub_ps(vyi, _mm512_loadu_ps(&s.y[j]));
+    __m512 dz = _mm512_sub_ps(vzi, _mm512_loadu_ps(&s.z[j]));
+    __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+
+    __m512 inv = _mm512_maskz_rsqrt14_ps(allLanes, r2);
+    inv = _mm512_mul_ps(_mm512_mul_ps(half, inv),
+                        _mm512_fnmadd_ps(_mm512_mul_ps(r2, inv), inv, three));
+    __m512 d = _mm512_add_ps(r2, veps);
+    __m512 rcp = _mm512_maskz_rcp14_ps(allLanes, d);
+    rcp = _mm512_mul_ps(rcp, _mm512_fnmadd_ps(d, rcp, two));
+
+    __mmask16 live = _mm512_cmp_ps_mask(r2, zero, _CMP_GT_OQ);
+    __m512 k = _mm512_maskz_mul_ps(live, vk, _mm512_mul_ps(inv, rcp));
+    dx = _mm512_mul_ps(dx, k), dy = _mm512_mul_ps(dy, k), dz = _mm512_mul_ps(dz, k);
+
+    ax = _mm512_add_ps(ax, dx), ay = _mm512_add_ps(ay, dy), az = _mm512_add_ps(az, dz);
+    _mm512_storeu_ps(fx + j, _mm512_sub_ps(_mm512_loadu_ps(fx + j), dx));
+    _mm512_storeu_ps(fy + j, _mm512_sub_ps(_mm512_loadu_ps(fy + j), dy));
+    _mm512_storeu_ps(fz + j, _mm512_sub_ps(_mm512_loadu_ps(fz + j), dz));
+  }
+
+  addLanes(halves(ax), fx[i]), addLanes(halves(ay), fy[i]), addLanes(halves(az), fz[i]);
+  rowScalar(s, fx, fy, fz, i, body, j1, chargeK, epsilon);
+}
+
+#endif  // PAIR_KERNEL_X86
+
+typedef void (*RowFunction)(const ParticleSoA&, float*, float*, float*, int,
+                            int, int, float, float);
+
+// widest row kernel this CPU can run
+inline RowFunction bestRow() {
+#ifdef PAIR_KERNEL_X86
+  static RowFunction best = [] {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return (RowFunction)rowAVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+      return (RowFunction)rowAVX2;
+    return (RowFunction)rowScalar;
+  }();
+  return best;
+#else
+  return rowScalar;
+#endif
+}
+
+inline const char* bestRowName() {
+  RowFunction row = bestRow();
+#ifdef PAIR_KERNEL_X86
+  if (row == (RowFunction)rowAVX512) return "avx512";
+  if (row == (RowFunction)rowAVX2) return "avx2";
+#endif
+  return row == (RowFunction)rowScalar ? "scalar" : "?";
+}
+
+// rows [i0, i1) against every j > i. tiles of `tile` particles keep the j
+// block and its forces in L1 while the i block streams over it
+inline void coulombRows(const ParticleSoA& s, float* fx, float* fy, float* fz,
+                        int i0, int i1, float chargeK, float epsilon,
+                        int tile = 512, RowFunction row = bestRow()) {
+  int n = s.size();
+  for (int J = i0; J < n; J += tile) {
+    int jEnd = std::min(J + tile, n);
+    for (int i = i0; i < i1 && i < jEnd; ++i) {
+      int j0 = std::max(J, i + 1);
+      if (j0 < jEnd) row(s, fx, fy, fz, i, j0, jEnd, chargeK, epsilon);
+    }
+  }
+}
+
+}  // namespace pair_kernel
+
+// all pairs, tiled: each block of `tile` rows sweeps the rest of the set
+inline void coulombTiled(ParticleSoA& s, float chargeK, float epsilon,
+                         int tile = 512) {
+  for (int I = 0; I < s.size(); I += tile)
+    pair_kernel::coulombRows(s, s.fx.data(), s.fy.data(), s.fz.data(), I,
+                             std::min(I + tile, s.size()), chargeK, epsilon,
+                             tile);
+}
+
+// all pairs on every core. a pair (i, j) adds to both i and j, so two threads
+// would race on j; instead each task owns a full set of force arrays. the
+// rows are split so every task gets about the same number of pairs, then the
+// buffers are summed per particle in task order, which keeps the result
+// bit-for-bit the same from run to run for a given pool size
+struct PairBuffers {
+  std::vector<int> rowStart;  // task t owns rows [rowStart[t], rowStart[t + 1])
+  std::vector<float> f;       // task t, axis a: f[(3 * t + a) * n ...]
+};
+
+inline void coulombParallel(ThreadPool& pool, ParticleSoA& s,
+                            PairBuffers& buffers, float chargeK, float epsilon,
+                            int tile = 512) {
+  int n = s.size();
+  int tasks = std::max(1, std::min(pool.size(), n / 64));
+
+  // row i has n - 1 - i pairs; cut the triangle into equal areas
+  buffers.rowStart.assign(tasks + 1, n);
+  double total = 0.5 * n * (n - 1.0), pairs = 0;
+  int t = 0;
+  buffers.rowStart[0] = 0;
+  for (int i = 0; i < n && t + 1 < tasks; ++i) {
+    pairs += n - 1 - i;
+    if (pairs >= total * (t + 1) / tasks) buffers.rowStart[++t] = i + 1;
+  }
+  buffers.f.resize((size_t)3 * tasks * n);
+
+  pool.run(tasks, [&](int t) {
+    int i0 = buffers.rowStart[t], i1 = buffers.rowStart[t + 1];
+    float* fx = &buffers.f[(size_t)(3 * t + 0) * n];
+    float* fy = &buffers.f[(size_t)(3 * t + 1) * n];
+    float* fz = &buffers.f[(size_t)(3 * t + 2) * n];
+    // only [i0, n) is ever written by these rows
+    std::fill(fx + i0, fx + n, 0.0f);
+    std::fill(fy + i0, fy + n, 0.0f);
+    std::fill(fz + i0, fz + n, 0.0f);
+    for (int I = i0; I < i1; I += tile)
+      pair_kernel::coulombRows(s, fx, fy, fz, I, std::min(I + tile, i1),
+                               chargeK, epsilon, tile);
+  });
+
+  // reduce: particle i only has contributions from tasks starting at or
+  // before it
+  pool.parallelFor(n, [&](int begin, int end) {
+    for (int t = 0; t < tasks; ++t) {
+      int from = std::max(begin, buffers.rowStart[t]);
+      const float* fx = &buffers.f[(size_t)(3 * t + 0) * n];
+      const float* fy = &buffers.f[(size_t)(3 * t + 1) * n];
+      const float* fz = &buffers.f[(size_t)(3 * t + 2) * n];
+      for (int i = from; i < end; ++i)
+        s.fx[i] += fx[i], s.fy[i] += fy[i], s.fz[i] += fz[i];
+    }
+  });
+}
@@ -7,27 +7,55 @@
 
 using namespace al;
 
-#include <fstream>
+#include <atomic>
+#include <chrono>
 #include <vector>
 using namespace std;
 
+#include "barnes_hut.hpp"
+#include "cell_list.hpp"
+#include "pair_kernel.hpp"
+#include "integrators.hpp"
+#include "sim_pipeline.hpp"
+#include "trajectory.hpp"
+#include "../common/sim_thread.hpp"
+#include "../common/triple_buffer.hpp"
+#include "../common/asset_loader.hpp"
+
 Vec3f randomVec3f(float scale) {
   return Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS()) * scale;
 }
-string slurp(string fileName);  // forward declaration
 
 struct AlloApp : App {
   float sphereRadius = 5.0f;
   vector<Vec3f> anchorDirs;
   Parameter pointSize{"/pointSize", "", 3.0, 1.0, 3.0};
-  Parameter timeStep{"/timeStep", "", 0.08, 0.02, 0.1};
+  Parameter timeStep{"/timeStep", "", 0.08, 0.02, 0.5};
+  ParameterMenu scheme{"/integrator"};
+  ParameterInt substeps{"/substeps", "", 1, 1, 16};
+  Parameter substepMs{"/substepMs", "", 0, 0, 100};  // readout, cpu per substep
+  Parameter stepMs{"/stepMs", "", 0, 0, 100};  // readout, cpu per 1/60 s simulated
+  ParameterInt particleCount{"/particleCount", "", 1000, 1, 1000000};
   Parameter dragFactor{"/dragFactor", "", 0.90, 0.0, 0.99};
   Parameter springK{"/sprinK", "", 0.04, 0.01, 0.5};
   Parameter chargeK{"/chargeK", "", 0.00, 0.0, 0.9};
+  ParameterMenu forceMode{"/forceMode"};
+  enum { EXACT, BARNES_HUT, CELL_LIST, SIMD };  // forceMode entries
+  Parameter theta{"/theta", "", 0.5, 0.0, 1.0};  // Barnes-Hut opening angle
+  Parameter cutoff{"/cutoff", "", 1.0, 0.1, 5.0};  // cell list radius
+  Parameter neighbors{"/neighbors", "", 0, 0, 1000};  // readout, per particle
+  ParameterBool multithread{"/multithread", "", 1};
+  ParameterBool simThread{"/simThread", "", 0};  // physics off the render thread
+  ParameterBool record{"/record", "", 0};  // every step to trajectoryFile
+  ParameterBool quantize16{"/quantize16", "", 0};  // 16-bit positions when recording
+  ParameterBool replay{"/replay", "", 0};  // play trajectoryFile back instead
+  ParameterInt replayFrame{"/replayFrame", "", 0, 0, 0};  // scrub while frozen
    
   //
 
   ShaderProgram pointShader;
+  AssetLoader assets;  // reads (and re-reads) the shader files off-thread
+  bool shaderReady = false;
 
   //  simulation state
   Mesh mesh;  // position *is inside the mesh* mesh.vertices() are the positions
@@ -35,6 +63,34 @@ struct AlloApp : App {
   vector<Vec3f> force;
   vector<float> mass;
 
+  BarnesHut barnesHut;  // octree, rebuilt every step
+  CellList cellList;    // uniform grid, rebuilt every step
+  ParticleSoA soa;      // float arrays for the simd kernel
+  PairBuffers pairBuffers;  // one force set per thread
+  ThreadPool pool;      // one thread per core
+
+  // key presses that touch the simulation wait here for its next tick
+  atomic<bool> freeze{false};
+  atomic<bool> kickRequested{false}, timingRequested{false},
+      errorRequested{false};
+
+  // with /simThread on, the simulation owns `mesh` on its own thread and
+  // hands finished frames to onDraw through `frames`, which draws `drawMesh`
+  struct Frame {
+    vector<Vec3f> position;
+    vector<Color> color;
+    vector<Vec2f> size;
+  };
+  TripleBuffer<Frame> frames;
+  SimThread sim;
+  Mesh drawMesh{Mesh::POINTS};
+
+  // recording belongs to the simulation; replay to the render thread, and the
+  // simulation is stopped while it runs
+  string trajectoryFile = "particles.traj";
+  TrajectoryWriter recorder;
+  TrajectoryReader player;
+  long long stepCount = 0;
 
   void onInit() override {
     // set up GUI
@@ -42,101 +98,180 @@ struct AlloApp : App {
     auto &gui = GUIdomain->newGUI();
     gui.add(pointSize);  // add parameter to GUI
     gui.add(timeStep);   // add parameter to GUI
+    scheme.setElements({"semi-implicit euler", "velocity verlet", "rk4"});
+    gui.add(scheme);
+    gui.add(substeps);
+    gui.add(substepMs);
+    gui.add(stepMs);  // real time while this stays under 16.7
+    gui.add(particleCount);
     gui.add(dragFactor);   // add parameter to GUI
     gui.add(springK);
     gui.add(chargeK);
+    forceMode.setElements({"exact", "barnes-hut", "cell list", "exact simd"});
+    gui.add(forceMode);
+    gui.add(theta);
+    gui.add(cutoff);
+    gui.add(neighbors);
+    gui.add(multithread);
+    gui.add(simThread);
+    gui.add(record);
+    gui.add(quantize16);
+    gui.add(replay);
+    gui.add(replayFrame);
+    printf("simd pair kernel: %s\n", pair_kernel::bestRowName());
 
     //
   }
 
   void onCreate() override {
-    // compile shaders
-    pointShader.compile(slurp("../point-vertex.glsl"),
-                        slurp("../point-fragment.glsl"),
-                        slurp("../point-geometry.glsl"));
+    // compile shaders once they are loaded, and again whenever one is saved
+    assets.watch({"../point-vertex.glsl", "../point-fragment.glsl",
+                  "../point-geometry.glsl"},
+                 [this](const vector<AssetLoader::Bytes> &source) {
+                   shaderReady = source[0] && source[1] && source[2] &&
+                                 pointShader.compile(*source[0], *source[1],
+                                                     *source[2]);
+                   if (!shaderReady) printf("point shader failed to compile\n");
+                 });
 
     // set initial conditions of the simulation
     //
 
-    // c++11 "lambda" function
-    auto randomColor = []() { return HSV(rnd::uniform(), 1.0f, 1.0f); };
-
     mesh.primitive(Mesh::POINTS);
     // does 1000 work on your system? how many can you make before you get a low
-    // frame rate? do you need to use <1000?
-    for (int _ = 0; _ < 1000; _++) {
-      Vec3f dir = randomVec3f(1.0f).normalize();
-      anchorDirs.push_back(dir);
-      mesh.vertex(dir * (sphereRadius + rnd::uniformS(1.0f)));
-      mesh.color(randomColor());
+    // frame rate? /particleCount changes it while running; watch /stepMs
+    resizeParticles(particleCount);
 
-      // float m = rnd::uniform(3.0, 0.5);
-      float m = 3 + rnd::normal() / 2;
-      if (m < 0.5) m = 0.5;
-      mass.push_back(m);
+    nav().pos(0, 0, 50);
+    buildPipeline();
+  }
 
-      // using a simplified volume/size relationship
-      mesh.texCoord(pow(m, 1.0f / 3), 0);  // s, t
+  void onAnimate(double dt) override {
+    assets.poll();  // shader (re)compiles happen here
 
-      // separate state arrays
-      velocity.push_back(randomVec3f(0.1));
-      force.push_back(randomVec3f(1));
+    if (replay) {
+      replayStep();
+      return;
     }
+    if (player.isOpen()) player.close();
 
-    nav().pos(0, 0, 50);
+    if (simThread && !sim.running())
+      sim.start([this](double dt) { simulate(dt, true); });
+    if (!simThread && sim.running()) sim.stop();
+    if (!sim.running()) simulate(dt, false);
   }
 
-  bool freeze = false;
-
-  void onAnimate(double dt) override {
+  // runs on the render thread or on `sim`, never both at once
+  void simulate(double dt, bool publish) {
+    handleRequests();
     if (freeze) return;
-  
+
+    // 60 steps of timeStep per second whatever the frame rate, each one cut
+    // into `substeps` smaller steps
+    int steps = clock.advance(dt, 1.0 / (60 * substeps), 8 * substeps);
+    float h = timeStep / substeps;
+    auto start = chrono::steady_clock::now();
+    for (int s = 0; s < steps; ++s) {
+      integrator.step(scheme, h, mesh.vertices(), velocity, force, mass,
+                      [this] { pipeline.step(); });
+      stepCount++;
+      if (recorder.isOpen()) recorder.record(stepCount, mesh.vertices(), velocity);
+    }
+    if (steps > 0) {
+      double ms = chrono::duration<double, milli>(
+                      chrono::steady_clock::now() - start).count();
+      substepMs.set(ms / steps);
+      stepMs.set(ms / steps * substeps);
+    }
+
+    if (publish && steps > 0) {
+      Frame &frame = frames.writeBuffer();
+      frame.position = mesh.vertices();
+      frame.color = mesh.colors();
+      frame.size = mesh.texCoord2s();
+      frames.publish();
+    }
+  }
+
+  FixedStepClock clock;
+  Integrator integrator;
+
+  // forces for whatever is in position/velocity right now, one stage at a
+  // time. the integrator runs this once or more per substep
+  SimPipeline pipeline;
+  float epsilon = 0.001f;  // softening, keeps 1/r^2 finite
+
+  void buildPipeline() {
+    pipeline.add("clear", [this] { clearForces(); });
+    pipeline.add("spring", [this] { springForces(); });
+    pipeline.add("drag", [this] { dragForces(); });
+    pipeline.add("pair forces", [this] { pairForces(); });
+  }
+
+  // 0. Clear all forces
+  void clearForces() {
+    for (auto &f : force) f.set(0);
+  }
+
+  // 1. Hooke’s Law: pull particles to sphere surface
+  void springForces() {
     vector<Vec3f> &position(mesh.vertices());
-  
-    // Hooke's Law parameters
-    float epsilon = 0.001f;  
-    
-    // 1. Hooke’s Law: pull particles to sphere surface
     for (int i = 0; i < position.size(); ++i) {
       Vec3f a = position[i];
       Vec3f b = anchorDirs[i] * sphereRadius;
       Vec3f displacement = b - a;
       force[i] += springK.get() * displacement;
     }
-   
-        // drag
-        for (int i = 0; i < velocity.size(); i++) {
-          force[i] += - velocity[i] * dragFactor;
-        }
-
-    // columbus Law
-    for (int i = 0; i < position.size(); ++i) {
-      for (int j = i + 1; j < position.size(); ++j) {
-        Vec3f dir = position[i] - position[j];
-        float distSqr = dir.magSqr() + epsilon;
-        float strength = chargeK / distSqr;
-        Vec3f repulsion = dir.normalize(strength);
-  
-        force[i] += repulsion;
-        force[j] -= repulsion;  // Equal and opposite
-      }
-
+  }
 
-    // Integration
-    //
+  // 2. drag
+  void dragForces() {
     for (int i = 0; i < velocity.size(); i++) {
-      // "semi-implicit" Euler integration
-      velocity[i] += force[i] / mass[i] * timeStep;
-      position[i] += velocity[i] * timeStep;
+      force[i] += - velocity[i] * dragFactor;
     }
-
-    // 4. Clear all forces
-    for (auto &f : force) f.set(0);
   }
-  
-};
 
-    // 
+  // 3. columbus Law
+  void pairForces() {
+    vector<Vec3f> &position(mesh.vertices());
+    if (forceMode.get() == BARNES_HUT) {
+      // Barnes-Hut: O(n log n), error set by theta
+      barnesHut.theta = theta;
+      barnesHut.build(position);
+      if (multithread)
+        barnesHut.accumulate(pool, position, force, chargeK, epsilon);
+      else
+        barnesHut.accumulate(position, force, chargeK, epsilon);
+    } else if (forceMode.get() == CELL_LIST) {
+      // short range only: O(n), nothing beyond the cutoff
+      cellList.build(position, cutoff);
+      if (multithread)
+        cellList.accumulate(pool, position, force, chargeK, epsilon, cutoff);
+      else
+        cellList.accumulate(position, force, chargeK, epsilon, cutoff);
+      neighbors.set(cellList.neighborsPerParticle);
+    } else if (forceMode.get() == SIMD) {
+      // same pairs as below, tiled and vectorized over float arrays
+      soa.load(position);
+      if (multithread)
+        coulombParallel(pool, soa, pairBuffers, chargeK, epsilon);
+      else
+        coulombTiled(soa, chargeK, epsilon);
+      soa.addForcesTo(force);
+    } else {
+      for (int i = 0; i < position.size(); ++i) {
+        for (int j = i + 1; j < position.size(); ++j) {
+          Vec3f dir = position[i] - position[j];
+          float distSqr = dir.magSqr() + epsilon;
+          float strength = chargeK / distSqr;
+          Vec3f repulsion = dir.normalize(strength);
+
+          force[i] += repulsion;
+          force[j] -= repulsion;  // Equal and opposite
+        }
+      }
+    }
+  }
 
     // XXX you put code here that calculates gravitational forces and sets
     // accelerations These are pair-wise. Each unique pairing of two particles
@@ -158,31 +293,182 @@ struct AlloApp : App {
 
 
 
-  bool onKeyDown(const Keyboard &k) override {
-    if (k.key() == ' ') {
-      freeze = !freeze;
+  void addParticle() {
+    // c++11 "lambda" function
+    auto randomColor = []() { return HSV(rnd::uniform(), 1.0f, 1.0f); };
+
+    Vec3f dir = randomVec3f(1.0f).normalize();
+    anchorDirs.push_back(dir);
+    mesh.vertex(dir * (sphereRadius + rnd::uniformS(1.0f)));
+    mesh.color(randomColor());
+
+    // float m = rnd::uniform(3.0, 0.5);
+    float m = 3 + rnd::normal() / 2;
+    if (m < 0.5) m = 0.5;
+    mass.push_back(m);
+
+    // using a simplified volume/size relationship
+    mesh.texCoord(pow(m, 1.0f / 3), 0);  // s, t
+
+    // separate state arrays
+    velocity.push_back(randomVec3f(0.1));
+    force.push_back(Vec3f(0));
+  }
+
+  // grow or shrink every per-particle array together. capacity only ever
+  // grows, in powers of two, so dragging the slider back and forth does not
+  // reallocate; new particles start fresh, removed ones are dropped
+  void resizeParticles(int n) {
+    size_t capacity = velocity.capacity();
+    if (n > capacity) {
+      capacity = max<size_t>(capacity, 1024);
+      while (capacity < n) capacity *= 2;
+      mesh.vertices().reserve(capacity);
+      mesh.colors().reserve(capacity);
+      mesh.texCoord2s().reserve(capacity);
+      anchorDirs.reserve(capacity);
+      velocity.reserve(capacity);
+      force.reserve(capacity);
+      mass.reserve(capacity);
+    }
+    while (velocity.size() < n) addParticle();
+    if (velocity.size() > n) {
+      mesh.vertices().resize(n);
+      mesh.colors().resize(n);
+      mesh.texCoord2s().resize(n);
+      anchorDirs.resize(n);
+      velocity.resize(n);
+      force.resize(n);
+      mass.resize(n);
+    }
+    integrator.invalidate();
+  }
+
+  // show the next recorded frame, or the one on the slider while frozen
+  void replayStep() {
+    sim.stop();
+    if (recorder.isOpen()) {
+      recorder.close();
+      record.set(false);
+    }
+    if (!player.isOpen()) {
+      if (!player.open(trajectoryFile) || player.frames() == 0) {
+        printf("nothing to replay in %s\n", trajectoryFile.c_str());
+        player.close();
+        replay.set(false);
+        return;
+      }
+      printf("replaying %lld frames of %d particles\n", player.frames(),
+             player.particles());
+      replayFrame.max(player.frames() - 1);
+      replayFrame.set(0);
+    }
+    if (!freeze) replayFrame.set((replayFrame + 1) % player.frames());
+
+    int n = player.particles();
+    player.positions(replayFrame, drawMesh.vertices());
+    if (drawMesh.colors().size() != n) {
+      if (mesh.colors().size() == n) {
+        drawMesh.colors() = mesh.colors();
+        drawMesh.texCoord2s() = mesh.texCoord2s();
+      } else {
+        drawMesh.colors().assign(n, Color(1));
+        drawMesh.texCoord2s().assign(n, Vec2f(1, 0));
+      }
+    }
+  }
+
+  void handleRequests() {
+    if (particleCount != (int)velocity.size()) {
+      if (recorder.isOpen()) {
+        // a recording has one particle count
+        printf("recorded %lld steps\n", recorder.frames());
+        recorder.close();
+        record.set(false);
+      }
+      resizeParticles(particleCount);
     }
 
-    if (k.key() == '1') {
-      // introduce some "random" forces
+    if (record && !recorder.isOpen()) {
+      if (recorder.open(trajectoryFile, velocity.size(), quantize16, true))
+        printf("recording to %s\n", trajectoryFile.c_str());
+      else
+        record.set(false);
+    }
+    if (!record && recorder.isOpen()) {
+      printf("recorded %lld steps\n", recorder.frames());
+      recorder.close();
+    }
+
+    if (kickRequested.exchange(false)) {
+      // introduce some "random" forces, as one step's worth of push
       for (int i = 0; i < velocity.size(); i++) {
         // F = ma
-        force[i] += randomVec3f(1);
+        velocity[i] += randomVec3f(1) / mass[i] * timeStep;
       }
-      
+      integrator.invalidate();
     }
 
+    if (timingRequested.exchange(false)) {
+      // where does the step time go?
+      printf("%d particles, %s:\n", (int)velocity.size(),
+             forceMode.getCurrent().c_str());
+      printf("per force evaluation:\n");
+      pipeline.print();
+      printf("per substep, %s:\n", scheme.getCurrent().c_str());
+      printf("  %-12s %9.3f ms x %d evaluations\n", "forces",
+             pipeline.averageStepMs, integrator.evaluations);
+      printf("  %-12s %9.3f ms\n", "integrate", integrator.updateMs);
+      printf("  %-12s %9.3f ms\n", "substep", substepMs.get());
+    }
+
+    if (errorRequested.exchange(false)) {
+      // how far is the tree from the exact kernel right now?
+      barnesHut.theta = theta;
+      barnesHut.build(mesh.vertices());
+      printf("barnes-hut theta %.2f: rms relative error %g\n", theta.get(),
+             coulombError(mesh.vertices(), barnesHut, chargeK, epsilon));
+    }
+  }
+
+  bool onKeyDown(const Keyboard &k) override {
+    if (k.key() == ' ') {
+      freeze = !freeze;
+    }
+
+    if (k.key() == '1') kickRequested = true;
+    if (k.key() == 't') timingRequested = true;
+    if (k.key() == 'e') errorRequested = true;
+
     return true;
   }
 
+  void onExit() override {
+    sim.stop();
+    recorder.close();
+  }
+
   void onDraw(Graphics &g) override {
     g.clear(0.3);
+    if (!shaderReady) return;
     g.shader(pointShader);
     g.shader().uniform("pointSize", pointSize / 100);
     g.blending(true);
     g.blendTrans();
     g.depthTesting(true);
-    g.draw(mesh);
+    if (replay && player.isOpen()) {
+      g.draw(drawMesh);
+    } else if (sim.running()) {
+      if (frames.update()) {
+        const Frame &frame = frames.readBuffer();
+        drawMesh.vertices() = frame.position;
+        drawMesh.colors() = frame.color;
+        drawMesh.texCoord2s() = frame.size;
+      }
+      g.draw(drawMesh);
+    } else {
+      g.draw(mesh);
+    }
   }
 };
 
@@ -191,14 +477,3 @@ int main() {
   app.configureAudio(48000, 512, 2, 0);
   app.start();
 }
-
-string slurp(string fileName) {
-  fstream file(fileName);
-  string returnValue = "";
-  while (file.good()) {
-    string line;
-    getline(file, line);
-    returnValue += line + "\n";
-  }
-  return returnValue;
-}
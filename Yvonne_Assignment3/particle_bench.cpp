@@ -0,0 +1,284 @@
+// Headless benchmark for the particle.cpp force model
+//
+// Same simulation as particle.cpp (springs to the sphere, drag, Coulomb
+// repulsion, fixed-step integrator) without a window, with a fixed seed, so
+// runs can be compared. Sweeps particle count, force kernel and thread count
+// and prints one CSV row per combination:
+//
+//   n,kernel,threads,integrator,steps,steps_per_sec,interactions_per_step,
+//   ns_per_interaction,energy_drift
+//
+// ns_per_interaction is wall time divided by pair (or cell) force
+// evaluations, so with more threads it goes down. energy_drift is
+// |E_end - E_start| / |E_start| over the timed steps (not the warm-up
+// step); drag defaults to 0 so the energy should be conserved and the
+// drift shows integrator and approximation error. Above 20000 particles the Coulomb potential is
+// estimated from 256 sample particles.
+//
+// build (only needs the allolib headers):
+//   cmake -S . -B build && cmake --build build && ./build/particle_bench
+// or
+//   c++ -O3 -std=c++17 -pthread -I path/to/allolib/include particle_bench.cpp
+//
+// options (lists are comma separated):
+//   --n 1000,10000,100000,1000000
+//   --kernel naive,simd,barnes-hut,cell-list
+//   --threads 1,<cores>
+//   --steps 10          --integrator euler|verlet|rk4
+//   --theta 0.5         --cutoff 0.3      --drag 0
+//   --budget 2e10       skip all-pairs runs needing more pair evaluations
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "al/math/al_Vec.hpp"
+
+#include "barnes_hut.hpp"
+#include "cell_list.hpp"
+#include "integrators.hpp"
+#include "pair_kernel.hpp"
+
+using namespace al;
+using namespace std;
+
+struct Options {
+  vector<long long> n = {1000, 10000, 100000, 1000000};
+  vector<string> kernel = {"naive", "simd", "barnes-hut", "cell-list"};
+  vector<long long> threads;
+  int steps = 10;
+  string integrator = "euler";
+  float theta = 0.5f;
+  float cutoff = 0.3f;
+  float drag = 0;
+  double budget = 2e10;
+};
+
+// the particle.cpp state, seeded
+struct BenchSim {
+  float sphereRadius = 5.0f;
+  float timeStep = 0.08f;
+  float springK = 0.04f;
+  float chargeK;
+  float dragFactor;
+  float epsilon = 0.001f;
+  float theta, cutoff;
+  string kernel;
+
+  vector<Vec3f> position, velocity, force, anchorDirs;
+  vector<float> mass;
+
+  BarnesHut barnesHut;
+  CellList cellList;
+  ParticleSoA soa;
+  PairBuffers pairBuffers;
+  ThreadPool* pool = nullptr;
+  long long interactions = 0;  // last force evaluation
+
+  void init(int n, unsigned seed) {
+    mt19937 rng(seed);
+    uniform_real_distribution<float> uniformS(-1, 1);
+    normal_distribution<float> normal;
+    auto randomVec3f = [&](float scale) {
+      return Vec3f(uniformS(rng), uniformS(rng), uniformS(rng)) * scale;
+    };
+    for (int i = 0; i < n; ++i) {
+      Vec3f dir = randomVec3f(1.0f).normalize();
+      anchorDirs.push_back(dir);
+      position.push_back(dir * (sphereRadius + uniformS(rng)));
+      float m = 3 + normal(rng) / 2;
+      if (m < 0.5) m = 0.5;
+      mass.push_back(m);
+      velocity.push_back(randomVec3f(0.1));
+      force.push_back(Vec3f(0));
+    }
+    // keep the total charge the same as n grows
+    chargeK = 10.0f / n;
+  }
+
+  void forces() {
+    int n = position.size();
+    for (auto &f : force) f.set(0);
+    for (int i = 0; i < n; ++i)
+      force[i] += springK * (anchorDirs[i] * sphereRadius - position[i]);
+    for (int i = 0; i < n; ++i) force[i] += -velocity[i] * dragFactor;
+
+    bool parallel = pool->size() > 1;
+    if (kernel == "barnes-hut") {
+      barnesHut.theta = theta;
+      barnesHut.build(position);
+      if (parallel)
+        barnesHut.accumulate(*pool, position, force, chargeK, epsilon);
+      else
+        barnesHut.accumulate(position, force, chargeK, epsilon);
+      interactions = barnesHut.interactions;
+    } else if (kernel == "cell-list") {
+      cellList.build(position, cutoff);
+      if (parallel) {
+        cellList.accumulate(*pool, position, force, chargeK, epsilon, cutoff);
+        interactions = (long long)(cellList.neighborsPerParticle * n);
+      } else {
+        cellList.accumulate(position, force, chargeK, epsilon, cutoff);
+        interactions = (long long)(cellList.neighborsPerParticle * n / 2);
+      }
+    } else if (kernel == "simd") {
+      soa.load(position);
+      if (parallel)
+        coulombParallel(*pool, soa, pairBuffers, chargeK, epsilon);
+      else
+        coulombTiled(soa, chargeK, epsilon);
+      soa.addForcesTo(force);
+      interactions = (long long)n * (n - 1) / 2;
+    } else {
+      coulombExact(position, force, chargeK, epsilon);
+      interactions = (long long)n * (n - 1) / 2;
+    }
+  }
+
+  // kinetic + spring + Coulomb, the last one matching the kernel's force
+  // (cut off at `cutoff` for the cell list)
+  double energy() const {
+    int n = position.size();
+    double kinetic = 0, spring = 0;
+    for (int i = 0; i < n; ++i) {
+      kinetic += 0.5 * mass[i] * velocity[i].magSqr();
+      spring += 0.5 * springK * (anchorDirs[i] * sphereRadius - position[i]).magSqr();
+    }
+
+    // U(r) = k / sqrt(eps) * (pi/2 - atan(r / sqrt(eps))), so that
+    // -dU/dr = k / (r^2 + eps)
+    double root = sqrt(epsilon);
+    auto potential = [&](double r) {
+      return chargeK / root * (M_PI / 2 - atan(r / root));
+    };
+    bool cut = kernel == "cell-list";
+    double shift = cut ? potential(cutoff) : 0;
+    int samples = n > 20000 ? 256 : n;
+    double coulomb = 0;
+    for (int s = 0; s < samples; ++s) {
+      int i = (long long)s * n / samples;
+      for (int j = 0; j < n; ++j) {
+        if (j == i) continue;
+        double r = (position[i] - position[j]).mag();
+        if (cut && r >= cutoff) continue;
+        coulomb += potential(r) - shift;
+      }
+    }
+    coulomb *= 0.5 * n / samples;  // every pair was counted from both ends
+    return kinetic + spring + coulomb;
+  }
+};
+
+static vector<string> splitList(const string &s) {
+  vector<string> out;
+  stringstream in(s);
+  string item;
+  while (getline(in, item, ',')) out.push_back(item);
+  return out;
+}
+
+static int usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [--n 1000,10000,...] [--kernel naive,simd,barnes-hut,cell-list]\n"
+          "       [--threads 1,4] [--steps 10] [--integrator euler|verlet|rk4]\n"
+          "       [--theta 0.5] [--cutoff 0.3] [--drag 0] [--budget 2e10]\n",
+          program);
+  return 1;
+}
+
+static vector<long long> splitNumbers(const string &s) {
+  vector<long long> out;
+  for (auto &item : splitList(s)) out.push_back((long long)atof(item.c_str()));
+  return out;
+}
+
+int main(int argc, char *argv[]) {
+  Options o;
+  o.threads = {1, (long long)thread::hardware_concurrency()};
+  if (o.threads[1] <= 1) o.threads.pop_back();
+
+  for (int a = 1; a < argc; a += 2) {
+    if (a + 1 == argc) return usage(argv[0]);  // an option without its value
+    string key = argv[a], value = argv[a + 1];
+    if (key == "--n") o.n = splitNumbers(value);
+    else if (key == "--kernel") o.kernel = splitList(value);
+    else if (key == "--threads") o.threads = splitNumbers(value);
+    else if (key == "--steps") o.steps = atoi(value.c_str());
+    else if (key == "--integrator") o.integrator = value;
+    else if (key == "--theta") o.theta = atof(value.c_str());
+    else if (key == "--cutoff") o.cutoff = atof(value.c_str());
+    else if (key == "--drag") o.drag = atof(value.c_str());
+    else if (key == "--budget") o.budget = atof(value.c_str());
+    else {
+      fprintf(stderr, "unknown option %s\n", key.c_str());
+      return usage(argv[0]);
+    }
+  }
+
+  if (o.integrator != "euler" && o.integrator != "verlet" && o.integrator != "rk4") {
+    fprintf(stderr, "unknown integrator %s\n", o.integrator.c_str());
+    return usage(argv[0]);
+  }
+  int scheme = o.integrator == "rk4"      ? Integrator::RK4
+               : o.integrator == "verlet" ? Integrator::VELOCITY_VERLET
+                                          : Integrator::SEMI_IMPLICIT_EULER;
+
+  fprintf(stderr, "simd pair kernel: %s\n", pair_kernel::bestRowName());
+  printf("n,kernel,threads,integrator,steps,steps_per_sec,"
+         "interactions_per_step,ns_per_interaction,energy_drift\n");
+
+  for (long long threads : o.threads) {
+    ThreadPool pool(threads);
+    for (long long n : o.n) {
+      for (auto &kernel : o.kernel) {
+        bool allPairs = kernel == "naive" || kernel == "simd";
+        if (kernel == "naive" && threads > 1) continue;  // single-threaded by design
+        double evaluations = scheme == Integrator::RK4 ? 4 : 1;
+        if (allPairs && 0.5 * n * n * o.steps * evaluations > o.budget) {
+          fprintf(stderr, "skipping %s at n=%lld (over --budget)\n",
+                  kernel.c_str(), n);
+          continue;
+        }
+
+        BenchSim sim;
+        sim.kernel = kernel;
+        sim.theta = o.theta;
+        sim.cutoff = o.cutoff;
+        sim.dragFactor = o.drag;
+        sim.pool = &pool;
+        sim.init(n, 2022);
+
+        Integrator integrator;
+        auto step = [&] {
+          integrator.step(scheme, sim.timeStep, sim.position, sim.velocity,
+                          sim.force, sim.mass, [&] { sim.forces(); });
+        };
+
+        step();  // warm up: first touch of every buffer
+        double before = sim.energy();  // the drift covers the timed steps only
+        long long interactions = 0;
+        auto start = chrono::steady_clock::now();
+        for (int s = 0; s < o.steps; ++s) {
+          step();
+          interactions += sim.interactions * integrator.evaluations;
+        }
+        double seconds =
+            chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        double after = sim.energy();
+
+        printf("%lld,%s,%lld,%s,%d,%.4g,%.4g,%.4g,%.3e\n", n, kernel.c_str(),
+               threads, o.integrator.c_str(), o.steps, o.steps / seconds,
+               (double)interactions / o.steps,
+               interactions > 0 ? 1e9 * seconds / interactions : 0.0,
+               fabs(after - before) / fabs(before));
+        fflush(stdout);
+      }
+    }
+  }
+}
@@ -0,0 +1,56 @@
+// A pass of the simulation as a flat list of named stages
+//
+// Each stage is its own function and they run one after the other, so a
+// stage can never end up nested inside another one's loop (the way the
+// integrator once ran inside the Coulomb `for i`). Every stage is timed;
+// print() shows a smoothed per-stage cost. particle.cpp uses one for the
+// force evaluation that the integrator calls.
+
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct SimPipeline {
+  struct Stage {
+    std::string name;
+    std::function<void()> run;
+    double ms = 0;         // last step
+    double averageMs = 0;  // smoothed over ~30 steps
+  };
+
+  std::vector<Stage> stages;
+  double stepMs = 0;  // whole step, last time
+  double averageStepMs = 0;
+
+  void add(const std::string& name, std::function<void()> run) {
+    Stage stage;
+    stage.name = name;
+    stage.run = std::move(run);
+    stages.push_back(stage);
+  }
+
+  // run every stage once, in order
+  void step() {
+    typedef std::chrono::steady_clock Clock;
+    stepMs = 0;
+    for (auto& s : stages) {
+      auto start = Clock::now();
+      s.run();
+      s.ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+      s.averageMs += (s.ms - s.averageMs) / 30;
+      stepMs += s.ms;
+    }
+    averageStepMs += (stepMs - averageStepMs) / 30;
+  }
+
+  void print() const {
+    for (auto& s : stages)
+      printf("  %-12s %9.3f ms %5.1f%%\n", s.name.c_str(), s.averageMs,
+             averageStepMs > 0 ? 100 * s.averageMs / averageStepMs : 0.0);
+    printf("  %-12s %9.3f ms\n", "step", averageStepMs);
+  }
+};
@@ -0,0 +1,264 @@
+// Recording particle runs to disk and playing them back
+//
+// TrajectoryWriter appends one frame per simulation step: positions (and
+// optionally velocities) stored SoA, x[] y[] z[] vx[] vy[] vz[], as floats or
+// quantized to 16 bits between that frame's per-axis min and max. Frames are
+// collected into chunks of about `chunkBytes` (at least one frame) and each
+// full chunk is written by a background thread while the next one fills, so
+// the simulation only waits on the disk if it is more than a whole chunk
+// ahead. Two chunks are held at a time, so recording costs 2 * chunkBytes of
+// memory, or two frames if a frame is bigger than that.
+//
+// Every frame has the same size, so frame f starts at
+// sizeof(FileHeader) + f * frameBytes. TrajectoryReader mmaps the file and
+// seeking anywhere is that multiplication; positions() decodes one frame
+// straight into a vector (mesh.vertices()). The frame count comes from the
+// file size, so a run that crashed mid-recording still plays up to its last
+// complete chunk.
+//
+// file layout (native endianness, everything 8-byte aligned):
+//   FileHeader                          64 bytes
+//   frame 0: FrameHeader                64 bytes
+//            channel x, y, z (, vx, vy, vz), each n floats or n uint16_t,
+//            padded to a multiple of 8 bytes
+//   frame 1: ...
+//
+// POSIX only (mmap).
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "al/math/al_Vec.hpp"
+
+namespace trajectory {
+
+enum Flags { QUANTIZED = 1, VELOCITY = 2 };
+
+struct FileHeader {
+  char magic[4] = {'P', 'T', 'R', 'J'};
+  uint32_t version = 1;
+  uint32_t particles = 0;
+  uint32_t flags = 0;
+  uint64_t frameBytes = 0;
+  uint32_t framesPerChunk = 0;
+  char unused[36] = {};
+};
+
+struct FrameHeader {
+  int64_t step = 0;
+  float lo[6] = {};     // per channel: value = lo + q * scale when quantized
+  float scale[6] = {};
+  char unused[8] = {};
+};
+
+static_assert(sizeof(FileHeader) == 64, "file header is 64 bytes");
+static_assert(sizeof(FrameHeader) == 64, "frame header is 64 bytes");
+
+inline size_t channelBytes(uint32_t particles, uint32_t flags) {
+  size_t bytes = particles * (flags & QUANTIZED ? sizeof(uint16_t) : sizeof(float));
+  return (bytes + 7) & ~size_t(7);
+}
+
+inline int channels(uint32_t flags) { return flags & VELOCITY ? 6 : 3; }
+
+inline size_t frameBytes(uint32_t particles, uint32_t flags) {
+  return sizeof(FrameHeader) + channels(flags) * channelBytes(particles, flags);
+}
+
+}  // namespace trajectory
+
+class TrajectoryWriter {
+ public:
+  ~TrajectoryWriter() { close(); }
+
+  bool isOpen() const { return file != nullptr; }
+  long long frames() const { return recorded; }
+
+  bool open(const std::string& path, int particles, bool quantize,
+            bool withVelocity, size_t chunkBytes = 4 << 20) {
+    close();
+    file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+    header = trajectory::FileHeader();
+    header.particles = particles;
+    header.flags = (quantize ? trajectory::QUANTIZED : 0) |
+                   (withVelocity ? trajectory::VELOCITY : 0);
+    header.frameBytes = trajectory::frameBytes(particles, header.flags);
+    header.framesPerChunk = (uint32_t)std::max<size_t>(1, chunkBytes / header.frameBytes);
+    fwrite(&header, sizeof(header), 1, file);
+    chunk.assign(header.frameBytes * header.framesPerChunk, 0);
+    framesInChunk = 0;
+    recorded = 0;
+    return true;
+  }
+
+  // velocity is ignored unless the file was opened withVelocity
+  void record(long long step, const std::vector<al::Vec3f>& position,
+              const std::vector<al::Vec3f>& velocity) {
+    if (!file || position.size() != header.particles) return;
+    char* frame = chunk.data() + framesInChunk * header.frameBytes;
+    trajectory::FrameHeader fh;
+    fh.step = step;
+    char* data = frame + sizeof(trajectory::FrameHeader);
+    size_t stride = trajectory::channelBytes(header.particles, header.flags);
+    for (int c = 0; c < trajectory::channels(header.flags); ++c) {
+      const std::vector<al::Vec3f>& source = c < 3 ? position : velocity;
+      encode(source, c % 3, data + c * stride, fh.lo[c], fh.scale[c]);
+    }
+    memcpy(frame, &fh, sizeof(fh));
+    recorded++;
+    if (++framesInChunk == (int)header.framesPerChunk) flush();
+  }
+
+  void close() {
+    if (!file) return;
+    flush();
+    if (writer.joinable()) writer.join();
+    fclose(file);
+    file = nullptr;
+  }
+
+ private:
+  FILE* file = nullptr;
+  trajectory::FileHeader header;
+  std::vector<char> chunk, writing;  // filling, and on its way to disk
+  int framesInChunk = 0;
+  long long recorded = 0;
+  std::thread writer;
+
+  void flush() {
+    if (framesInChunk == 0) return;
+    if (writer.joinable()) writer.join();
+    std::swap(chunk, writing);
+    chunk.resize(writing.size());
+    size_t bytes = framesInChunk * header.frameBytes;
+    writer = std::thread([this, bytes] { fwrite(writing.data(), 1, bytes, file); });
+    framesInChunk = 0;
+  }
+
+  void encode(const std::vector<al::Vec3f>& source, int axis, char* out,
+              float& lo, float& scale) {
+    int n = header.particles;
+    if (!(header.flags & trajectory::QUANTIZED)) {
+      float* f = (float*)out;
+      for (int i = 0; i < n; ++i) f[i] = source[i][axis];
+      lo = 0;
+      scale = 1;
+      return;
+    }
+    float hi = lo = n > 0 ? source[0][axis] : 0;
+    for (int i = 0; i < n; ++i) {
+      lo = std::min(lo, source[i][axis]);
+      hi = std::max(hi, source[i][axis]);
+    }
+    scale = (hi - lo) / 65535;
+    float inverse = scale > 0 ? 1 / scale : 0;
+    uint16_t* q = (uint16_t*)out;
+    for (int i = 0; i < n; ++i)
+      q[i] = (uint16_t)std::min(65535L, std::lround((source[i][axis] - lo) * inverse));
+  }
+};
+
+class TrajectoryReader {
+ public:
+  ~TrajectoryReader() { close(); }
+
+  bool isOpen() const { return data != nullptr; }
+  int particles() const { return header.particles; }
+  long long frames() const { return frameCount; }
+  bool quantized() const { return header.flags & trajectory::QUANTIZED; }
+  bool hasVelocity() const { return header.flags & trajectory::VELOCITY; }
+
+  bool open(const std::string& path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(header)) {
+      ::close(fd);
+      return false;
+    }
+    void* map = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);  // the mapping keeps the file
+    if (map == MAP_FAILED) return false;
+    memcpy(&header, map, sizeof(header));
+    if (memcmp(header.magic, "PTRJ", 4) != 0 || header.version != 1 ||
+        header.frameBytes != trajectory::frameBytes(header.particles, header.flags)) {
+      munmap(map, info.st_size);
+      return false;
+    }
+    data = (const char*)map;
+    size = info.st_size;
+    frameCount = (size - sizeof(header)) / header.frameBytes;
+    return true;
+  }
+
+  void close() {
+    if (data) munmap((void*)data, size);
+    data = nullptr;
+    size = 0;
+    frameCount = 0;
+  }
+
+  // the simulation step frame f was recorded at; -1 when there are no frames
+  long long step(long long f) const {
+    if (!data || frameCount == 0) return -1;
+    return frameHeader(f).step;
+  }
+
+  // decode frame f into `out` (resized to particles(); no allocation when it
+  // already is)
+  void positions(long long f, std::vector<al::Vec3f>& out) const { decode(f, 0, out); }
+  void velocities(long long f, std::vector<al::Vec3f>& out) const {
+    if (hasVelocity()) decode(f, 3, out);
+  }
+
+ private:
+  trajectory::FileHeader header;
+  const char* data = nullptr;
+  size_t size = 0;
+  long long frameCount = 0;
+
+  const char* frame(long long f) const {
+    f = std::max(0LL, std::min(f, frameCount - 1));
+    return data + sizeof(header) + f * header.frameBytes;
+  }
+
+  const trajectory::FrameHeader& frameHeader(long long f) const {
+    return *(const trajectory::FrameHeader*)frame(f);
+  }
+
+  void decode(long long f, int firstChannel, std::vector<al::Vec3f>& out) const {
+    int n = header.particles;
+    out.resize(n);
+    if (!data || frameCount == 0) return;
+    const trajectory::FrameHeader& fh = frameHeader(f);
+    const char* channel = frame(f) + sizeof(trajectory::FrameHeader);
+    size_t stride = trajectory::channelBytes(header.particles, header.flags);
+    for (int axis = 0; axis < 3; ++axis) {
+      int c = firstChannel + axis;
+      const char* in = channel + c * stride;
+      if (quantized()) {
+        const uint16_t* q = (const uint16_t*)in;
+        float lo = fh.lo[c], scale = fh.scale[c];
+        for (int i = 0; i < n; ++i) out[i][axis] = lo + q[i] * scale;
+      } else {
+        const float* v = (const float*)in;
+        for (int i = 0; i < n; ++i) out[i][axis] = v[i];
+      }
+    }
+  }
+};
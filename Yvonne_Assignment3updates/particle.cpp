@@ -7,28 +7,43 @@
 
 using namespace al;
 
-#include <fstream>
+#include <chrono>
 #include <vector>
 using namespace std;
 
+#include "../Yvonne_Assignment3/cell_list.hpp"
+#include "../Yvonne_Assignment3/pair_kernel.hpp"
+#include "../Yvonne_Assignment3/integrators.hpp"
+#include "../Yvonne_Assignment3/sim_pipeline.hpp"
+#include "../common/asset_loader.hpp"
+
 Vec3f randomVec3f(float scale) {
   return Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS()) * scale;
 }
-string slurp(string fileName);  // forward declaration
 
 struct AlloApp : App {
   float sphereRadius = 5.0f;
   vector<Vec3f> anchorDirs;
   Parameter pointSize{"/pointSize", "", 3.0, 1.0, 3.0};
-  Parameter timeStep{"/timeStep", "", 0.08, 0.02, 0.1};
+  Parameter timeStep{"/timeStep", "", 0.08, 0.02, 0.5};
+  ParameterMenu scheme{"/integrator"};
+  ParameterInt substeps{"/substeps", "", 1, 1, 16};
+  Parameter substepMs{"/substepMs", "", 0, 0, 100};  // readout, cpu per substep
   Parameter dragFactor{"/dragFactor", "", 0.90, 0.0, 0.99};
   Parameter springK{"/sprinK", "", 0.04, 0.01, 0.5};
   Parameter chargeK{"/chargeK", "", 0.00, 0.0, 0.9};
   Parameter Restlength{"/RestLength", "", 0.01, 0.0, 0.9};
+  ParameterMenu forceMode{"/forceMode"};
+  enum { EXACT, CELL_LIST, SIMD };  // forceMode entries
+  Parameter cutoff{"/cutoff", "", 1.0, 0.1, 5.0};  // cell list radius
+  Parameter neighbors{"/neighbors", "", 0, 0, 1000};  // readout, per particle
+  ParameterBool multithread{"/multithread", "", 1};
    
   //
 
   ShaderProgram pointShader;
+  AssetLoader assets;  // reads (and re-reads) the shader files off-thread
+  bool shaderReady = false;
 
   //  simulation state
   Mesh mesh;  // position *is inside the mesh* mesh.vertices() are the positions
@@ -36,6 +51,11 @@ struct AlloApp : App {
   vector<Vec3f> force;
   vector<float> mass;
 
+  CellList cellList;  // uniform grid, rebuilt every step
+  ParticleSoA soa;    // float arrays for the simd kernel
+  PairBuffers pairBuffers;  // one force set per thread
+  ThreadPool pool;    // one thread per core
+
 
   void onInit() override {
     // set up GUI
@@ -43,19 +63,34 @@ struct AlloApp : App {
     auto &gui = GUIdomain->newGUI();
     gui.add(pointSize);  // add parameter to GUI
     gui.add(timeStep);   // add parameter to GUI
+    scheme.setElements({"semi-implicit euler", "velocity verlet", "rk4"});
+    gui.add(scheme);
+    gui.add(substeps);
+    gui.add(substepMs);
     gui.add(dragFactor);   // add parameter to GUI
     gui.add(springK);
     gui.add(chargeK);
     gui.add(Restlength);
+    forceMode.setElements({"exact", "cell list", "exact simd"});
+    gui.add(forceMode);
+    gui.add(cutoff);
+    gui.add(neighbors);
+    gui.add(multithread);
+    printf("simd pair kernel: %s\n", pair_kernel::bestRowName());
 
     //
   }
 
   void onCreate() override {
-    // compile shaders
-    pointShader.compile(slurp("../point-vertex.glsl"),
-                        slurp("../point-fragment.glsl"),
-                        slurp("../point-geometry.glsl"));
+    // compile shaders once they are loaded, and again whenever one is saved
+    assets.watch({"../point-vertex.glsl", "../point-fragment.glsl",
+                  "../point-geometry.glsl"},
+                 [this](const vector<AssetLoader::Bytes> &source) {
+                   shaderReady = source[0] && source[1] && source[2] &&
+                                 pointShader.compile(*source[0], *source[1],
+                                                     *source[2]);
+                   if (!shaderReady) printf("point shader failed to compile\n");
+                 });
 
     // set initial conditions of the simulation
     //
@@ -82,24 +117,56 @@ struct AlloApp : App {
 
       // separate state arrays
       velocity.push_back(randomVec3f(0.1));
-      force.push_back(randomVec3f(1));
+      force.push_back(Vec3f(0));
     }
 
     nav().pos(0, 0, 50);
+    buildPipeline();
   }
 
   bool freeze = false;
 
   void onAnimate(double dt) override {
+    assets.poll();  // shader (re)compiles happen here
+
     if (freeze) return;
-  
+
+    // 60 steps of timeStep per second whatever the frame rate, each one cut
+    // into `substeps` smaller steps
+    int steps = clock.advance(dt, 1.0 / (60 * substeps), 8 * substeps);
+    float h = timeStep / substeps;
+    auto start = chrono::steady_clock::now();
+    for (int s = 0; s < steps; ++s)
+      integrator.step(scheme, h, mesh.vertices(), velocity, force, mass,
+                      [this] { pipeline.step(); });
+    if (steps > 0)
+      substepMs.set(chrono::duration<double, milli>(
+                        chrono::steady_clock::now() - start).count() / steps);
+  }
+
+  FixedStepClock clock;
+  Integrator integrator;
+
+  // forces for whatever is in position/velocity right now, one stage at a
+  // time. the integrator runs this once or more per substep
+  SimPipeline pipeline;
+  float epsilon = 0.001f;  // softening, keeps 1/r^2 finite
+
+  void buildPipeline() {
+    pipeline.add("clear", [this] { clearForces(); });
+    pipeline.add("spring", [this] { springForces(); });
+    pipeline.add("drag", [this] { dragForces(); });
+    pipeline.add("pair forces", [this] { pairForces(); });
+  }
+
+  // 0. Clear all forces
+  void clearForces() {
+    for (auto &f : force) f.set(0);
+  }
+
+  // 1. Hooke’s Law: pull particles to sphere surface
+  void springForces() {
     vector<Vec3f> &position(mesh.vertices());
-  
-    // Hooke's Law parameters
-    float epsilon = 0.001f;  
-    
-    // 1. Hooke’s Law: pull particles to sphere surface
-    
     for (int i = 0; i < position.size(); ++i) {
       Vec3f a = position[i]; //current position
       Vec3f b = anchorDirs[i] * sphereRadius;
@@ -108,40 +175,50 @@ struct AlloApp : App {
       Vec3f direction = displacement.normalized();
       Vec3f springForce = springK.get() * (currentLength - Restlength) * direction;
       force[i] += springForce;
-      
     }
-   
-        // drag
-        for (int i = 0; i < velocity.size(); i++) {
-          force[i] += - velocity[i] * dragFactor;
-        }
-
-    // columbus Law
-    for (int i = 0; i < position.size(); ++i) {
-      for (int j = i + 1; j < position.size(); ++j) {
-        Vec3f dir = position[i] - position[j];
-        float distSqr = dir.magSqr() + epsilon;
-        float strength = chargeK / distSqr;
-        Vec3f repulsion = dir.normalize(strength);
-  
-        force[i] += repulsion;
-        force[j] -= repulsion;  // Equal and opposite
-      }
-
+  }
 
-    // Integration
-    //
+  // 2. drag
+  void dragForces() {
     for (int i = 0; i < velocity.size(); i++) {
-      // "semi-implicit" Euler integration
-      velocity[i] += force[i] / mass[i] * timeStep;
-      position[i] += velocity[i] * timeStep;
+      force[i] += - velocity[i] * dragFactor;
+    }
+  }
+
+  // 3. columbus Law
+  void pairForces() {
+    vector<Vec3f> &position(mesh.vertices());
+    if (forceMode.get() == CELL_LIST) {
+      // short range only: O(n), nothing beyond the cutoff
+      cellList.build(position, cutoff);
+      if (multithread)
+        cellList.accumulate(pool, position, force, chargeK, epsilon, cutoff);
+      else
+        cellList.accumulate(position, force, chargeK, epsilon, cutoff);
+      neighbors.set(cellList.neighborsPerParticle);
+    } else if (forceMode.get() == SIMD) {
+      // same pairs as below, tiled and vectorized over float arrays
+      soa.load(position);
+      if (multithread)
+        coulombParallel(pool, soa, pairBuffers, chargeK, epsilon);
+      else
+        coulombTiled(soa, chargeK, epsilon);
+      soa.addForcesTo(force);
+    } else {
+      for (int i = 0; i < position.size(); ++i) {
+        for (int j = i + 1; j < position.size(); ++j) {
+          Vec3f dir = position[i] - position[j];
+          float distSqr = dir.magSqr() + epsilon;
+          float strength = chargeK / distSqr;
+          Vec3f repulsion = dir.normalize(strength);
+
+          force[i] += repulsion;
+          force[j] -= repulsion;  // Equal and opposite
+        }
+      }
     }
 
-    // 4. Clear all forces
-    for (auto &f : force) f.set(0);
   }
-  
-};
 
 
 
@@ -151,19 +228,34 @@ struct AlloApp : App {
     }
 
     if (k.key() == '1') {
-      // introduce some "random" forces
+      // introduce some "random" forces, as one step's worth of push
       for (int i = 0; i < velocity.size(); i++) {
         // F = ma
-        force[i] += randomVec3f(1);
+        velocity[i] += randomVec3f(1) / mass[i] * timeStep;
       }
+      integrator.invalidate();
       
     }
 
+    if (k.key() == 't') {
+      // where does the step time go?
+      printf("%d particles, %s:\n", (int)velocity.size(),
+             forceMode.getCurrent().c_str());
+      printf("per force evaluation:\n");
+      pipeline.print();
+      printf("per substep, %s:\n", scheme.getCurrent().c_str());
+      printf("  %-12s %9.3f ms x %d evaluations\n", "forces",
+             pipeline.averageStepMs, integrator.evaluations);
+      printf("  %-12s %9.3f ms\n", "integrate", integrator.updateMs);
+      printf("  %-12s %9.3f ms\n", "substep", substepMs.get());
+    }
+
     return true;
   }
 
   void onDraw(Graphics &g) override {
     g.clear(0.3);
+    if (!shaderReady) return;
     g.shader(pointShader);
     g.shader().uniform("pointSize", pointSize / 100);
     g.blending(true);
@@ -178,14 +270,3 @@ int main() {
   app.configureAudio(48000, 512, 2, 0);
   app.start();
 }
-
-string slurp(string fileName) {
-  fstream file(fileName);
-  string returnValue = "";
-  while (file.good()) {
-    string line;
-    getline(file, line);
-    returnValue += line + "\n";
-  }
-  return returnValue;
-}
@@ -29,6 +29,8 @@
 #include "al/io/al_MIDI.hpp"
 #include "al/math/al_Random.hpp"
 #include "_instrument_classes_Yvonne.cpp"
+#include "../common/sim_thread.hpp"
+#include "../common/triple_buffer.hpp"
 
 using namespace gam;
 using namespace al;
@@ -60,7 +62,7 @@ public:
   bool showGUI = true;
   bool showSpectro = true;
   bool navi = false;
-  float time;
+  float time = 0;
   float lastMeteorTime = 0.0f;
 
   gam::STFT stft = gam::STFT(FFT_SIZE, FFT_SIZE / 4, 0, gam::HANN, gam::MAG_FREQ);
@@ -104,6 +106,18 @@ T clamp(T val, T minVal, T maxVal) {
 
 std::vector<LightDot> lightDots;
 
+// everything onDraw needs from the scene. simulate() publishes one of these
+// after every step; with simThread on that happens on `sim`, so rendering
+// never waits on the scene and the scene never waits on vsync
+struct SceneFrame {
+  float time = 0;
+  std::vector<LightDot> lightDots;
+  std::vector<Raindrop> raindrops;
+  std::vector<MeteorLine> meteorLines;
+};
+TripleBuffer<SceneFrame> frames;
+SimThread sim;
+ParameterBool simThread{"simThread", "", 0};
 
 
 
@@ -196,6 +210,40 @@ lastMeteorTime = 0.0f;
   }
 
 void onAnimate(double dt) override {
+    if (simThread && !sim.running())
+      // the dots jitter a fixed amount per step, so keep the frame rate's pace
+      sim.start([this](double dt) { simulate(dt); }, 60);
+    if (!simThread && sim.running()) sim.stop();
+    if (!sim.running()) simulate(dt);
+
+    frames.update();
+    float time = frames.readBuffer().time;
+
+    // Camera zoom logic
+    if (time > 62.0f && time <= 102.0f) {
+        float t = (time - 62.0f) / 40.0f;   // Zoom in over 40 seconds
+        t = std::min(t, 1.0f);             // Clamp to 1.0
+        t = t * t * (3 - 2 * t);           // Smoothstep easing
+        float z = 2.0f + (-20.0f * t);     // 2.0 → -18.0
+        nav().pos(0, 0, z);
+    }
+    else if (time > 102.0f && time <= 142.0f) {  // Zoom out over 40 seconds
+        float t = (time - 102.0f) / 40.0f;  // t goes from 0 to 1
+        t = std::min(t, 1.0f);
+        t = t * t * (3 - 2 * t);  // smoothstep
+        float z = -18.0f + (20.0f * t);  // -18.0 → 2.0
+        nav().pos(0, 0, z);
+    }
+
+    imguiBeginFrame();
+    synthManager.drawSynthControlPanel();
+    ParameterGUI::drawParameterBool(&simThread);
+    imguiEndFrame();
+}
+
+// rain, meteors and light dots. runs on the render thread or on `sim`,
+// never both at once
+void simulate(double dt) {
     time += dt;
 
     // Rain logic - completely separate from meteor timing
@@ -268,22 +316,6 @@ void onAnimate(double dt) override {
         meteorLines.push_back(m);
     }
 
-    // Camera zoom logic
-    if (time > 62.0f && time <= 102.0f) {
-        float t = (time - 62.0f) / 40.0f;   // Zoom in over 40 seconds
-        t = std::min(t, 1.0f);             // Clamp to 1.0
-        t = t * t * (3 - 2 * t);           // Smoothstep easing
-        float z = 2.0f + (-20.0f * t);     // 2.0 → -18.0
-        nav().pos(0, 0, z);
-    }
-    else if (time > 102.0f && time <= 142.0f) {  // Zoom out over 40 seconds
-        float t = (time - 102.0f) / 40.0f;  // t goes from 0 to 1
-        t = std::min(t, 1.0f);
-        t = t * t * (3 - 2 * t);  // smoothstep
-        float z = -18.0f + (20.0f * t);  // -18.0 → 2.0
-        nav().pos(0, 0, z);
-    }
-
   
  for (auto &dot : lightDots) {
   float accel = 1.0f;   // 加速度（用于位置 jitter）
@@ -336,15 +368,24 @@ meteorLines.erase(std::remove_if(meteorLines.begin(), meteorLines.end(),
   [](const MeteorLine &m) { return m.progress > m.lifetime; }),
   meteorLines.end());
 
-
-    imguiBeginFrame();
-    synthManager.drawSynthControlPanel();
-    imguiEndFrame();
+SceneFrame &frame = frames.writeBuffer();
+frame.time = time;
+frame.lightDots = lightDots;
+frame.raindrops = raindrops;
+frame.meteorLines = meteorLines;
+frames.publish();
 }
 
 
   void onDraw(Graphics &g) override
   {
+    // the newest published scene, not the live one
+    const SceneFrame &scene = frames.readBuffer();
+    float time = scene.time;
+    const auto &lightDots = scene.lightDots;
+    const auto &raindrops = scene.raindrops;
+    const auto &meteorLines = scene.meteorLines;
+
     g.clear();
     // 绘制固定的闪烁球体
     g.pushMatrix();
@@ -375,7 +416,7 @@ meteorLines.erase(std::remove_if(meteorLines.begin(), meteorLines.end(),
       return (1 - t) * (1 - t) * a + 2 * (1 - t) * t * b + t * t * c;
     };
 
-    for (auto &m : meteorLines) {
+    for (const auto &m : meteorLines) {
       float t = m.progress / m.lifetime;
       if (t >= 1.0f) continue;
 
@@ -577,7 +618,10 @@ meteorLines.erase(std::remove_if(meteorLines.begin(), meteorLines.end(),
     return true;
   }
 
-  void onExit() override { imguiShutdown(); }
+  void onExit() override {
+    sim.stop();
+    imguiShutdown();
+  }
 };
 
 int main()
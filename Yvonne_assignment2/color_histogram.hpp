@@ -0,0 +1,94 @@
+// The distinct colors of an image, for drawing color-space layouts
+//
+// In a layout that places pixels by color alone (the rgb cube, the hsv
+// cylinder, ...) every pixel of the same color lands on the same spot, so
+// a photo's millions of points are mostly stacked duplicates. build()
+// quantizes each channel to `bits` bits (6: 262144 bins) and keeps one
+// entry per bin that is used, with the mean color of its pixels and how
+// many there were. A photo typically uses a few tens of thousands of bins,
+// one or two orders of magnitude fewer points than pixels.
+//
+// Up to four threads of the pool count their share of the pixels into
+// their own dense table; the tables are then added up and the empty bins
+// dropped.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "al/types/al_Color.hpp"
+
+#include "../common/thread_pool.hpp"
+#include "layout_bank.hpp"
+
+struct ColorHistogram {
+    int bits = 6;  // per channel
+    std::vector<al::Color> colors;  // mean color of each used bin
+    std::vector<uint32_t> counts;   // pixels in it
+
+    void build(const al::Color* pixels, size_t n, ThreadPool& pool) {
+        int levels = 1 << bits;
+        size_t bins = (size_t)levels * levels * levels;
+        // a table is 8 MB at 6 bits, so no more than four of them
+        int parts = std::max(1, std::min({pool.size(), 4, (int)(n / 65536) + 1}));
+        std::vector<std::vector<Bin>> tables(parts);
+        pool.run(parts, [&](int p) {
+            std::vector<Bin>& table = tables[p];
+            table.assign(bins, Bin());
+            size_t from = n * p / parts, to = n * (p + 1) / parts;
+            for (size_t i = from; i < to; ++i) {
+                const al::Color& c = pixels[i];
+                Bin& bin = table[index(c.r, levels) + levels * (index(c.g, levels) + levels * index(c.b, levels))];
+                bin.r += c.r;
+                bin.g += c.g;
+                bin.b += c.b;
+                bin.count++;
+            }
+        });
+
+        colors.clear();
+        counts.clear();
+        for (size_t i = 0; i < bins; ++i) {
+            Bin sum = tables[0][i];
+            for (int p = 1; p < parts; ++p) {
+                const Bin& b = tables[p][i];
+                sum.r += b.r;
+                sum.g += b.g;
+                sum.b += b.b;
+                sum.count += b.count;
+            }
+            if (sum.count == 0) continue;
+            colors.push_back(al::Color(sum.r / sum.count, sum.g / sum.count, sum.b / sum.count));
+            counts.push_back(sum.count);
+        }
+    }
+
+    size_t size() const { return colors.size(); }
+
+    // the bin colors as a layout source, rows of `width`, so a colorOnly
+    // layout in the bank can place them. the last row is padded with black;
+    // use the first size() positions
+    LayoutSource source(int width = 1024) {
+        padded = colors;
+        LayoutSource s;
+        s.width = width;
+        s.height = (int)((colors.size() + width - 1) / width);
+        padded.resize((size_t)s.width * s.height, al::Color(0, 0, 0));
+        s.colors = padded.data();
+        return s;
+    }
+
+private:
+    struct Bin {
+        double r = 0, g = 0, b = 0;
+        uint32_t count = 0;
+    };
+
+    std::vector<al::Color> padded;
+
+    static int index(float c, int levels) {
+        return std::min(std::max((int)(c * levels), 0), levels - 1);
+    }
+};
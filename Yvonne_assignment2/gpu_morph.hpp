@@ -0,0 +1,155 @@
+// The pixel cloud morph on the GPU
+//
+// Each layout is uploaded once, the first time it is shown, into a buffer of
+// its own. A transition binds three of them to attributes 4, 5 and 6
+// (from, via, to) and morph-vertex.glsl blends them, so a frame on the CPU
+// is one uniform: the time since the switch. The shader eases toward `to`
+// by `rate` per 60 Hz frame, passed in so that progress() here and the
+// shader agree; the CPU lerp uses the same rate.
+//
+// Switching in the middle of a transition starts the next one from where
+// the points are: mix(from, to, f) becomes the new from/via pair. Switching
+// again before that one ends would need a fourth stream, so instead the
+// current positions are worked out on the CPU and uploaded once into a
+// scratch buffer that becomes the new start (layout index -1).
+//
+// Only core GL 3.3 with no geometry shader, so it runs the same on Mesa's
+// llvmpipe as on a GPU.
+
+#pragma once
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "al/graphics/al_BufferObject.hpp"
+#include "al/graphics/al_Graphics.hpp"
+#include "al/graphics/al_OpenGL.hpp"
+#include "al/graphics/al_VAOMesh.hpp"
+#include "al/math/al_Vec.hpp"
+
+#include "../common/thread_pool.hpp"
+#include "layout_bank.hpp"
+
+struct GpuMorph {
+    float rate = 0.07f;  // of the remaining way, per 60 Hz frame
+
+    // start (or restart, for a new image) settled on `layout`. the layout
+    // streams are attached to the mesh's VAO
+    void reset(al::VAOMesh& mesh, int layout, LayoutBank& bank, ThreadPool& pool) {
+        vao = &mesh.vao();
+        // the GL buffers are kept from the last reset and refilled (a
+        // BufferObject does not free its buffer when it is destroyed)
+        while ((int)buffers.size() < bank.size()) buffers.emplace_back(new Layout);
+        for (auto& b : buffers) b->uploaded = false;
+        scratch.uploaded = false;
+        from = via = to = layout;
+        settled = 0;
+        time = 1e9;
+        bindLayouts(bank, pool);
+    }
+
+    void advance(double dt) { time += dt; }
+
+    // fraction of the way from start to `to`
+    float progress() const { return 1 - std::pow(1 - rate, (float)time * 60); }
+
+    void show(int layout, LayoutBank& bank, ThreadPool& pool) {
+        float f = progress();
+        if (f > 0.999f) {
+            from = via = to;  // arrived
+        } else if (from == via || settled == 0) {
+            via = to;  // the start was a single layout
+            settled = f;
+        } else {
+            std::vector<al::Vec3f> now(bank.get(to, pool).size());
+            positions(now, bank, pool);
+            scratchPositions.swap(now);
+            scratch.uploaded = false;
+            from = via = -1;
+            settled = 0;
+        }
+        to = layout;
+        time = 0;
+        bindLayouts(bank, pool);
+    }
+
+    // with a shader built from morph-vertex.glsl / morph-fragment.glsl
+    void draw(al::Graphics& g, al::ShaderProgram& shader, al::VAOMesh& mesh) {
+        g.shader(shader);
+        g.shader().uniform("time", (float)time);
+        g.shader().uniform("settled", settled);
+        g.shader().uniform("rate", rate);
+        g.draw(mesh);
+    }
+
+    // where the shader puts every point right now, for handing the morph
+    // back to the CPU
+    void positions(std::vector<al::Vec3f>& out, LayoutBank& bank, ThreadPool& pool) {
+        const std::vector<al::Vec3f>& a = cpu(from, bank, pool);
+        const std::vector<al::Vec3f>& b = cpu(via, bank, pool);
+        const std::vector<al::Vec3f>& c = cpu(to, bank, pool);
+        float f = progress(), s = settled;
+        pool.parallelFor(out.size(), [&](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                al::Vec3f start = a[i] + (b[i] - a[i]) * s;
+                out[i] = start + (c[i] - start) * f;
+            }
+        });
+    }
+
+    int target() const { return to; }
+
+private:
+    struct Layout {
+        al::BufferObject buffer;
+        bool created = false;
+        bool uploaded = false;
+    };
+
+    std::vector<std::unique_ptr<Layout>> buffers;
+    Layout scratch;  // layout -1: where the points were at a nested switch
+    std::vector<al::Vec3f> scratchPositions;
+    al::VAO* vao = nullptr;
+    int from = 0, via = 0, to = 0;
+    float settled = 0;
+    double time = 0;
+
+    const std::vector<al::Vec3f>& cpu(int layout, LayoutBank& bank, ThreadPool& pool) {
+        return layout < 0 ? scratchPositions : bank.get(layout, pool);
+    }
+
+    Layout& upload(int layout, LayoutBank& bank, ThreadPool& pool) {
+        Layout& l = layout < 0 ? scratch : *buffers[layout];
+        if (!l.uploaded) {
+            const std::vector<al::Vec3f>& p = cpu(layout, bank, pool);
+            if (!l.created) {
+                l.buffer.bufferType(GL_ARRAY_BUFFER);
+                l.buffer.usage(GL_STATIC_DRAW);
+                l.buffer.create();
+                l.created = true;
+            }
+            l.buffer.bind();
+            l.buffer.data(p.size() * sizeof(al::Vec3f), p.data());
+            l.buffer.unbind();
+            l.uploaded = true;
+        }
+        return l;
+    }
+
+    // the attributes live in the mesh's VAO, so this is done on a switch,
+    // not every frame
+    void bindLayouts(LayoutBank& bank, ThreadPool& pool) {
+        Layout& a = upload(from, bank, pool);
+        Layout& b = upload(via, bank, pool);
+        Layout& c = upload(to, bank, pool);
+        vao->bind();
+        vao->enableAttrib(4);
+        vao->attribPointer(4, a.buffer, 3);
+        vao->enableAttrib(5);
+        vao->attribPointer(5, b.buffer, 3);
+        vao->enableAttrib(6);
+        vao->attribPointer(6, c.buffer, 3);
+        vao->unbind();
+    }
+};
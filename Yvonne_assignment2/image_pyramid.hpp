@@ -0,0 +1,111 @@
+// A mip pyramid of a picture, kept within a pixel budget
+//
+// The pixel cloud costs far more per point than the picture does per pixel
+// (the mesh, every layout, their GPU copies: a few hundred bytes), so a
+// 100 MP photo would need tens of gigabytes; the cloud is made from a
+// smaller version of it instead. maxPixels is a pixel count; the caller
+// turns its memory budget into one.
+//
+// build() reads the source one row at a time, through a get(x, y, rgb)
+// function, and box-filters it straight down to the first level that fits
+// maxPixels (halving until it does). Only that level and the ones below it
+// are stored, 3 bytes a pixel, each half the size of the one before down to
+// about 4096 pixels, so the pyramid is at most 4 bytes per pixel of
+// maxPixels. The source itself is not bounded by this: whatever get() reads
+// from (the decoded image) is the caller's, at its full size. The output
+// rows are split over the pool, each thread working down its own strip of
+// the source.
+//
+// levelFor(points) picks the finest level with at most that many pixels: a
+// small one to show right away, a big one to refine to.
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "../common/thread_pool.hpp"
+
+struct ImagePyramid {
+    struct Level {
+        int width = 0, height = 0;
+        std::vector<uint8_t> rgb;  // row by row, 3 bytes a pixel
+
+        size_t pixels() const { return (size_t)width * height; }
+        const uint8_t* at(int x, int y) const { return &rgb[((size_t)y * width + x) * 3]; }
+    };
+
+    std::vector<Level> levels;  // levels[0] is the largest kept
+    size_t minPixels = 4096;    // no levels smaller than this
+    int scale = 1;              // levels[0] is the source shrunk this many times
+
+    // get(x, y, uint8_t rgb[3]) is called from the pool's threads
+    template <class Get>
+    void build(int width, int height, Get get, size_t maxPixels, ThreadPool& pool) {
+        levels.clear();
+        int shift = 0;
+        while (shift < 30 && (size_t)shrunk(width, shift) * shrunk(height, shift) > maxPixels &&
+               (shrunk(width, shift) > 1 || shrunk(height, shift) > 1))
+            shift++;
+        scale = 1 << shift;
+        levels.emplace_back();
+        reduce(width, height, shift, get, levels.back(), pool);
+
+        while (levels.back().pixels() / 4 >= minPixels) {
+            const Level& above = levels.back();
+            Level next;
+            reduce(above.width, above.height, 1, [&above](int x, int y, uint8_t* rgb) {
+                const uint8_t* p = above.at(x, y);
+                rgb[0] = p[0];
+                rgb[1] = p[1];
+                rgb[2] = p[2];
+            }, next, pool);
+            levels.push_back(std::move(next));
+        }
+    }
+
+    int size() const { return levels.size(); }
+
+    // the finest level with no more than `points` pixels, or the smallest
+    int levelFor(size_t points) const {
+        for (int i = 0; i < size(); ++i)
+            if (levels[i].pixels() <= points) return i;
+        return size() - 1;
+    }
+
+private:
+    static int shrunk(int n, int shift) { return (int)(((long long)n + (1LL << shift) - 1) >> shift); }
+
+    // out = the source box-filtered by 2^shift in each direction; blocks at
+    // the right and top edges average only the pixels they have
+    template <class Get>
+    static void reduce(int width, int height, int shift, const Get& get, Level& out, ThreadPool& pool) {
+        int f = 1 << shift;
+        out.width = shrunk(width, shift);
+        out.height = shrunk(height, shift);
+        out.rgb.resize(out.pixels() * 3);
+        pool.parallelFor(out.height, [&](int begin, int end) {
+            std::vector<uint64_t> sum((size_t)out.width * 3);
+            uint8_t px[3];
+            for (int oy = begin; oy < end; ++oy) {
+                std::fill(sum.begin(), sum.end(), 0);
+                int y0 = oy * f, y1 = std::min(height, y0 + f);
+                for (int y = y0; y < y1; ++y)
+                    for (int x = 0; x < width; ++x) {
+                        get(x, y, px);
+                        uint64_t* s = &sum[(size_t)(x >> shift) * 3];
+                        s[0] += px[0];
+                        s[1] += px[1];
+                        s[2] += px[2];
+                    }
+                uint8_t* row = &out.rgb[(size_t)oy * out.width * 3];
+                for (int ox = 0; ox < out.width; ++ox) {
+                    uint64_t n = (uint64_t)(y1 - y0) * (std::min(width, ox * f + f) - ox * f);
+                    for (int c = 0; c < 3; ++c) row[ox * 3 + c] = (uint8_t)((sum[ox * 3 + c] + n / 2) / n);
+                }
+            }
+        });
+    }
+};
@@ -0,0 +1,116 @@
+// Target layouts for the pixel cloud, each computed once
+//
+// A layout maps every pixel (its x, y and color) to a point in space. The
+// bank holds any number of them by index; get() builds a layout the first
+// time it is asked for, rows split over a thread pool, and after that it is
+// just a reference to the stored positions, so switching layouts costs
+// nothing. buildAll() does every layout up front instead, at the price of
+// 12 bytes per pixel per layout.
+//
+// New layouts are one call:
+//   bank.add("spiral", [](const LayoutSource& s, int x, int y, const Color& c) {
+//       return Vec3f(...);
+//   });
+// add() inlines the function into the row loop; addRows() takes a whole
+// range of rows at once for layouts that want to share work across pixels.
+// A layout registered as colorOnly places a pixel by its color alone (not
+// x or y), so build() can also run it on any list of colors, such as the
+// distinct colors of the image.
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "al/math/al_Vec.hpp"
+#include "al/types/al_Color.hpp"
+
+#include "../common/thread_pool.hpp"
+
+struct LayoutSource {
+    int width = 0, height = 0;
+    const al::Color* colors = nullptr;  // width * height, row by row
+
+    const al::Color& color(int x, int y) const { return colors[(size_t)y * width + x]; }
+};
+
+class LayoutBank {
+public:
+    // fill out[y * width + x] for every pixel in rows [y0, y1)
+    typedef std::function<void(const LayoutSource&, int y0, int y1, al::Vec3f* out)> RowBuilder;
+
+    // f(source, x, y, color) returns the pixel's position. returns the index
+    template <class F>
+    int add(const std::string& name, F f, bool colorOnly = false) {
+        return addRows(name, [f](const LayoutSource& s, int y0, int y1, al::Vec3f* out) {
+            for (int y = y0; y < y1; ++y)
+                for (int x = 0; x < s.width; ++x) {
+                    size_t i = (size_t)y * s.width + x;
+                    out[i] = f(s, x, y, s.colors[i]);
+                }
+        }, colorOnly);
+    }
+
+    int addRows(const std::string& name, RowBuilder build, bool colorOnly = false) {
+        layouts.push_back({name, build, colorOnly, {}, false});
+        return layouts.size() - 1;
+    }
+
+    // a new image: everything built so far is dropped
+    void setSource(const LayoutSource& s) {
+        source = s;
+        for (auto& l : layouts) {
+            l.positions.clear();
+            l.positions.shrink_to_fit();
+            l.built = false;
+        }
+    }
+
+    int size() const { return layouts.size(); }
+    bool colorOnly(int index) const { return layouts[index].colorOnly; }
+    const std::string& name(int index) const { return layouts[index].name; }
+
+    // -1 if there is none by that name
+    int find(const std::string& name) const {
+        for (int i = 0; i < size(); ++i)
+            if (layouts[i].name == name) return i;
+        return -1;
+    }
+
+    // the positions of layout `index`, one per pixel, built now if needed
+    const std::vector<al::Vec3f>& get(int index, ThreadPool& pool) {
+        Layout& l = layouts[index];
+        if (!l.built) {
+            l.positions.resize((size_t)source.width * source.height);
+            pool.parallelFor(source.height, [&](int y0, int y1) {
+                l.build(source, y0, y1, l.positions.data());
+            });
+            l.built = true;
+        }
+        return l.positions;
+    }
+
+    // run layout `index` on some other source, into out. not stored
+    void build(int index, const LayoutSource& s, std::vector<al::Vec3f>& out, ThreadPool& pool) {
+        Layout& l = layouts[index];
+        out.resize((size_t)s.width * s.height);
+        pool.parallelFor(s.height, [&](int y0, int y1) { l.build(s, y0, y1, out.data()); });
+    }
+
+    void buildAll(ThreadPool& pool) {
+        for (int i = 0; i < size(); ++i) get(i, pool);
+    }
+
+private:
+    struct Layout {
+        std::string name;
+        RowBuilder build;
+        bool colorOnly;
+        std::vector<al::Vec3f> positions;
+        bool built;
+    };
+
+    LayoutSource source;
+    std::vector<Layout> layouts;
+};
@@ -1,179 +1,405 @@
 #include "al/app/al_App.hpp"
+#include "al/graphics/al_BufferObject.hpp"
 #include "al/graphics/al_Image.hpp"
+#include "al/graphics/al_OpenGL.hpp"
+#include "al/graphics/al_VAOMesh.hpp"
 #include "al/math/al_Random.hpp"
 #include <fstream>
 #include <string>
+#include "../common/asset_loader.hpp"
+#include "../common/thread_pool.hpp"
+#include "color_histogram.hpp"
+#include "color_kernels.hpp"
+#include "gpu_morph.hpp"
+#include "image_pyramid.hpp"
+#include "layout_bank.hpp"
+#include "pixel_morph.hpp"
 
 using namespace al;
 
-struct PixelPoint {
-    Vec3f currentPos;
-    Vec3f targetPos;
-    Color color;
-}; //current pixel position, target pixel position, their color
-
 struct MyApp : App {
-    std::vector<PixelPoint> pixels;
-    Mesh mesh{Mesh::POINTS};
-    Image img;
-    int mode = 1; 
+    // one point per pixel. the current positions and colors are the mesh's
+    // own vertex and color arrays; each point heads for its place in the
+    // current layout
+    VAOMesh mesh{Mesh::POINTS};
+    BufferObject positions; // the GPU copy of mesh.vertices(), updated by tile
+    MorphTiles tiles;       // which parts of the picture are still moving
+    LayoutBank layouts;
+    ThreadPool pool;
+    int mode = 1; // key of the current layout, '1' is the first one registered
+    AssetLoader assets;
+    bool imageLoaded = false;
+
+    // the picture is kept as a mip pyramid (image_pyramid.hpp) whose
+    // largest level, once it is points, fits in memoryBudget (see
+    // bytesPerPoint). a small level is shown as soon as it is decoded, then
+    // the finest one is made on the loader thread and swapped in. '[' and
+    // ']' step through the levels
+    ImagePyramid pyramid;
+    ThreadPool loadPool; // only used from the loader thread
+    size_t memoryBudget = (size_t)1 << 30; // bytes, CPU and GPU together
+    size_t previewPoints = 1 << 18;
+    bool progressive = true;
+    int level = -1; // of the pyramid, the one the points are made from
+    int pendingLevel = -1; // being made on the loader thread
+    std::vector<Vec3f> nextVertices;
+    std::vector<Color> nextColors;
+    bool positionsCreated = false;
+
+    // 'g': the morph runs in morph-vertex.glsl instead, from layouts
+    // uploaded once (see gpu_morph.hpp)
+    GpuMorph gpu;
+    ShaderProgram morphShader;
+    bool morphShaderReady = false;
+    bool gpuMorph = false;
+
+    // 'd': once a color-only layout has settled, draw one point per distinct
+    // color (6 bits a channel) instead of one per pixel, as the same 2 pixel
+    // points, so the picture does not change. 'w' instead draws them as
+    // sprites sized by how many pixels they stand for
+    ColorHistogram histogram;
+    VAOMesh distinct{Mesh::POINTS};
+    int distinctLayout = -1; // layout distinct's positions are for
+    ShaderProgram spriteShader;
+    bool spriteShaderReady = false;
+    bool dedup = true;
+    bool weighted = false;
 
     void onCreate() override {
         nav().pos(0, 0, 3);
 
-        if (!img.load("../colorful.png")) {
-            std::cerr << "Failed to load image\n";
-            exit(1);
-        }
+        // keys 1, 2, 3, ... in this order. more can be added here
+        layouts.add("original", originalLayout);
+        layouts.add("rgb cube", rgbCube, true);
+        layouts.addRows("hsv cylinder", hsvCylinder, true);
+        layouts.addRows("color sphere", colorSphere);
+        layouts.addRows("hsl cylinder", hslCylinder, true);
+        layouts.addRows("lab space", labSpace, true);
 
-        int w = img.width();
-        int h = img.height();//fetching the width and height of the image
+        // same loading path as the point sprites; recompiles when saved
+        assets.watch({"../morph-vertex.glsl", "../morph-fragment.glsl"},
+                     [this](const std::vector<AssetLoader::Bytes>& source) {
+            morphShaderReady = source[0] && source[1] && morphShader.compile(*source[0], *source[1]);
+            if (!morphShaderReady) printf("Morph shader failed to compile\n");
+        });
+        assets.watch({"../point-vertex.glsl", "../point-fragment.glsl", "../point-geometry.glsl"},
+                     [this](const std::vector<AssetLoader::Bytes>& source) {
+            spriteShaderReady = source[0] && source[1] && source[2] && spriteShader.compile(*source[0], *source[1], *source[2]);
+            if (!spriteShaderReady) printf("Shader failed to compile\n");
+        });
 
-        for (int y = 0; y < h; ++y) {
-            for (int x = 0; x < w; ++x) { //getting all the (x,y) of the pixels
+        // decode the png on the loader thread and shrink it into the pyramid
+        // there; the full-size image is gone before the points are made
+        size_t pointBudget = memoryBudget / bytesPerPoint();
+        assets.async([this, pointBudget] {
+            Image img;
+            imageLoaded = img.load("../colorful.png");
+            if (!imageLoaded) return;
+            int h = img.height();
+            pyramid.build(img.width(), h, [&img, h](int x, int y, uint8_t* rgb) {
                 auto pixel = img.at(x, h - 1 - y); // manually flip Y so it is in correct orientation
-                Color c(pixel.r / 255.0, pixel.g / 255.0, pixel.b / 255.0); //change max 255 to max 1.(range)
-
-                Vec3f pos = Vec3f((float)x / w - 0.5, (float)y / h - 0.5, 0); //size the picture to fit the screen 
+                rgb[0] = pixel.r;
+                rgb[1] = pixel.g;
+                rgb[2] = pixel.b;
+            }, pointBudget, loadPool);
+            printf("%dx%d image, shrunk %dx to fit %d MB (%d points)\n", img.width(), h, pyramid.scale,
+                   (int)(memoryBudget >> 20), (int)pointBudget);
+        }, [this] {
+            if (!imageLoaded) {
+                std::cerr << "Failed to load image\n";
+                exit(1);
+            }
+            int first = progressive ? pyramid.levelFor(previewPoints) : 0;
+            makePoints(pyramid.levels[first], mesh.vertices(), mesh.colors(), pool);
+            buildPixels(first);
+            if (first != 0) refine(0);
+        });
+    }
 
-                PixelPoint p;
-                p.currentPos = pos;
-                p.targetPos = pos;
-                p.color = c;
+    // the most one point can cost, CPU and GPU together: its vertex and
+    // color in the mesh and again in the mesh's GPU buffers, the positions
+    // buffer, the staged copy while a finer level is made, every layout in
+    // the bank and its GPU morph stream, the GPU morph's scratch stream on
+    // both sides, and its pixel in the pyramid (3 bytes, plus a third for
+    // the smaller levels). not in it: the decoder's buffer, 4 bytes per
+    // pixel of the full image, which is freed before any points exist, and
+    // the histogram's 32 MB of tables while it counts
+    size_t bytesPerPoint() const {
+        size_t vertex = sizeof(Vec3f), color = sizeof(Color);
+        return 2 * (vertex + color) + vertex + (vertex + color) +
+               2 * vertex * layouts.size() + 2 * vertex + 4;
+    }
 
-                pixels.push_back(p);
-                mesh.vertex(pos);
-                mesh.color(c);
+    // one point per pixel of a pyramid level. rows are independent, so they
+    // are filled in parallel
+    static void makePoints(const ImagePyramid::Level& l, std::vector<Vec3f>& vertices,
+                           std::vector<Color>& colors, ThreadPool& pool) {
+        int w = l.width;
+        int h = l.height;
+        vertices.resize(l.pixels());
+        colors.resize(l.pixels());
+        pool.parallelFor(h, [&](int begin, int end) {
+            for (int y = begin; y < end; ++y) {
+                for (int x = 0; x < w; ++x) { //getting all the (x,y) of the pixels
+                    const uint8_t* pixel = l.at(x, y);
+                    size_t i = (size_t)y * w + x;
+                    colors[i] = Color(pixel[0] / 255.0, pixel[1] / 255.0, pixel[2] / 255.0); //change max 255 to max 1.(range)
+                    vertices[i] = Vec3f((float)x / w - 0.5, (float)y / h - 0.5, 0); //size the picture to fit the screen 
+                }
             }
+        });
+    }
+
+    // make the points of another level on the loader thread, and swap them
+    // in when they are done
+    void refine(int next) {
+        if (next == level || next == pendingLevel) return;
+        pendingLevel = next;
+        assets.async([this, next] { makePoints(pyramid.levels[next], nextVertices, nextColors, loadPool); },
+                     [this, next] {
+            if (pendingLevel != next) return; // another level was asked for since
+            pendingLevel = -1;
+            mesh.vertices().swap(nextVertices);
+            mesh.colors().swap(nextColors);
+            std::vector<Vec3f>().swap(nextVertices);
+            std::vector<Color>().swap(nextColors);
+            buildPixels(next);
+        });
+    }
+
+    // the mesh holds the points of pyramid level `next`, in the original layout
+    void buildPixels(int next) {
+        level = next;
+        const ImagePyramid::Level& l = pyramid.levels[level];
+        auto& vertices = mesh.vertices();
+        auto& colors = mesh.colors();
+
+        // layouts are built the first time their key is pressed
+        LayoutSource source;
+        source.width = l.width;
+        source.height = l.height;
+        source.colors = colors.data();
+        layouts.setSource(source);
+        tiles.reset(vertices.size());
+        histogram.build(colors.data(), colors.size(), pool);
+        distinctLayout = -1;
+        printf("%dx%d points, %d distinct colors\n", l.width, l.height, (int)histogram.size());
+
+        // a finer level comes in where the current layout has the points,
+        // not back on the flat picture
+        if (mode != 1) vertices = layouts.get(mode - 1, pool);
+
+        // colors go up once with the mesh. positions get their own buffer
+        // so that only the tiles that moved are sent again
+        mesh.update();
+        if (!positionsCreated) {
+            positions.bufferType(GL_ARRAY_BUFFER);
+            positions.usage(GL_DYNAMIC_DRAW);
+            positions.create();
+            positionsCreated = true;
         }
+        positions.bind();
+        positions.data(vertices.size() * sizeof(Vec3f), vertices.data());
+        positions.unbind();
+        mesh.vao().bind();
+        mesh.vao().attribPointer(0, positions, 3);
+        mesh.vao().unbind();
+        if (gpuMorph) gpu.reset(mesh, mode - 1, layouts, pool);
     }
 
     void onAnimate(double dt) override {
-        for (int i = 0; i < pixels.size(); i++) { //go over all the pixels 
-            
-            pixels[i].currentPos = lerp(pixels[i].currentPos, pixels[i].targetPos, 0.07f); //lerp here
-            mesh.vertices()[i] = pixels[i].currentPos;
+        assets.poll();
+        if (gpuMorph) {
+            gpu.advance(dt); // all the CPU does
+            return;
         }
+        if (mesh.vertices().empty() || tiles.asleep()) return; // nothing moves
+        tiles.step(mesh.vertices(), layouts.get(mode - 1, pool), gpu.rate, pool); //lerp here, at the GPU morph's rate
+
+        const Vec3f* v = mesh.vertices().data();
+        positions.bind();
+        tiles.forEachDirtyRun([&](size_t first, size_t count) {
+            positions.subdata(first * sizeof(Vec3f), count * sizeof(Vec3f), v + first);
+        });
+        positions.unbind();
     }
 
     void onDraw(Graphics& g) override {
         g.clear(0);
         g.pointSize(2.0);
+        if (showDistinct()) {
+            if (!weighted) {
+                g.meshColor();
+                g.draw(distinct);
+                return;
+            }
+            // the sprites overlap, so they need the depth test; it is put
+            // back the way it was for the other paths
+            bool depth = glIsEnabled(GL_DEPTH_TEST);
+            g.shader(spriteShader);
+            g.shader().uniform("pointSize", 0.004); // about the 2 pixels below, from the start view
+            g.depthTesting(true);
+            g.draw(distinct);
+            g.depthTesting(depth);
+            return;
+        }
+        if (gpuMorph) {
+            gpu.draw(g, morphShader, mesh);
+            return;
+        }
         g.meshColor();
         g.draw(mesh);
     }
 
     bool onKeyDown(const Keyboard& k) override {
-        if (k.key() == '1') {
-            mode = 1;
-            setOriginalLayout();
-        } else if (k.key() == '2') {
-            mode = 2;
-            setRGBCube();
-        } else if(k.key() == '3'){
-            mode = 3;
-            setHSVCylinder();  
+        if (mesh.vertices().empty()) return true;  // image still loading
+        int index = k.key() - '1';
+        if (index >= 0 && index < layouts.size()) {
+            mode = index + 1;
+            layouts.get(index, pool); // switching is free once it is built
+            if (gpuMorph)
+                gpu.show(index, layouts, pool);
+            else
+                tiles.wakeAll();
         }
-        else if (k.key() == '4') {
-            mode = 4;
-            setColorSphere();
+        if (k.key() == 'g') toggleGpuMorph();
+        if (k.key() == '[' && level + 1 < pyramid.size()) refine(level + 1);
+        if (k.key() == ']' && level > 0) refine(level - 1);
+        if (k.key() == 'd') dedup = !dedup;
+        if (k.key() == 'w') {
+            weighted = !weighted;
+            distinctLayout = -1; // sizes change
         }
         return true;
     }
 
-    void setOriginalLayout() {
-        int w = img.width();
-        int h = img.height();
-        int index = 0;
-        for (int y = 0; y < h; ++y) {
-            for (int x = 0; x < w; ++x) {
-                Vec3f pos = Vec3f((float)x / w - 0.5, (float)y / h - 0.5, 0);
-                pixels[index++].targetPos = pos;
-            }
-        }
+    // a color-only layout everyone has arrived at: the distinct colors look
+    // the same with a fraction of the points
+    bool showDistinct() {
+        int layout = mode - 1;
+        if (!dedup || (weighted && !spriteShaderReady) || histogram.size() == 0) return false;
+        if (!layouts.colorOnly(layout)) return false;
+        bool settled = gpuMorph ? gpu.target() == layout && gpu.progress() > 0.999f : tiles.asleep();
+        if (!settled) return false;
+        if (distinctLayout != layout) buildDistinct(layout);
+        return true;
     }
 
-    void setRGBCube() {
-        for (auto& p : pixels) {
-            p.targetPos = Vec3f(p.color.r - 0.5, p.color.g - 0.5, p.color.b - 0.5);
+    void buildDistinct(int layout) {
+        std::vector<Vec3f> where;
+        layouts.build(layout, histogram.source(), where, pool);
+        distinct.reset();
+        for (size_t i = 0; i < histogram.size(); ++i) {
+            distinct.vertex(where[i]);
+            distinct.color(histogram.colors[i]);
+            // point-geometry.glsl reads the size from texCoord.x
+            distinct.texCoord(weighted ? 1 + 0.5f * std::log2((float)histogram.counts[i]) : 1.0f, 0);
         }
+        distinct.update();
+        distinctLayout = layout;
     }
 
-    HSV rgbToHsv(Color c) {
-        float r = c.r;
-        float g = c.g;
-        float b = c.b;
-    
-        float max = std::max({r, g, b});
-        float min = std::min({r, g, b});
-        float delta = max - min;
-    
-        HSV out;
-        out.v = max;
-    
-        if (delta < 0.00001f) {
-            out.s = 0.0f;
-            out.h = 0.0f;
-            return out;
-        }
-    
-        out.s = (max > 0.0f) ? delta / max : 0.0f;
-    
-        if (r >= max)
-            out.h = (g - b) / delta;
-        else if (g >= max)
-            out.h = 2.0f + (b - r) / delta;
-        else
-            out.h = 4.0f + (r - g) / delta;
-    
-        out.h /= 6.0f;
-        if (out.h < 0.0f)
-            out.h += 1.0f;
-    
-        return out;
-    }
-    
-
-    void setHSVCylinder() {
-        for (auto& p : pixels) {
-            HSV hsv = rgbToHsv(p.color);
-            float angle = hsv.h * 2 * M_PI; // hue as angle in radians
-            float radius = hsv.s;           // saturation as radius
-            float y = (1 - hsv.v) - 0.5;          // value as height
-
-            float x = cos(angle) * radius;
-            float z = sin(angle) * radius;
-
-            p.targetPos = Vec3f(x, y, z);
+    void toggleGpuMorph() {
+        if (!gpuMorph) {
+            if (!morphShaderReady) {
+                printf("Morph shader not loaded, staying on the CPU\n");
+                return;
+            }
+            // starts settled on the current layout; a CPU transition still
+            // under way jumps to its end
+            gpu.reset(mesh, mode - 1, layouts, pool);
+            gpuMorph = true;
+        } else {
+            // carry on from where the shader had the points
+            auto& vertices = mesh.vertices();
+            gpu.positions(vertices, layouts, pool);
+            positions.bind();
+            positions.subdata(0, vertices.size() * sizeof(Vec3f), vertices.data());
+            positions.unbind();
+            tiles.wakeAll();
+            gpuMorph = false;
         }
+        printf("morph on the %s\n", gpuMorph ? "GPU" : "CPU");
     }
 
-    void setColorSphere() {
-        int w = img.width();
-        int h = img.height();
-        int index = 0;
-    
-        for (int y = 0; y < h; ++y) {
-            for (int x = 0; x < w; ++x) {
-                auto& p = pixels[index++];
-    
-                float brightness = (p.color.r + p.color.g + p.color.b) / 3.0f;
-    
-                // 用 x 和 y 映射到球面方向
-                float theta = float(x) / w * 2.0f * M_PI;       // 横向角度
-                float phi   = float(y) / h * M_PI;              // 纵向角度
-    
-                float r = brightness; // radius = brightness
-    
-                float sx = r * sin(phi) * cos(theta);
-                float sy = r * sin(phi) * sin(theta);
-                float sz = r * cos(phi);
-    
-                p.targetPos = Vec3f(sx, sy, sz);
+    static Vec3f originalLayout(const LayoutSource& s, int x, int y, const Color& c) {
+        return Vec3f((float)x / s.width - 0.5, (float)y / s.height - 0.5, 0);
+    }
+
+    static Vec3f rgbCube(const LayoutSource& s, int x, int y, const Color& c) {
+        return Vec3f(c.r - 0.5, c.g - 0.5, c.b - 0.5);
+    }
+
+    // the color-space layouts go through color_kernels.hpp a block of
+    // pixels at a time: hue/sat/value and sin/cos for 1024 points per call
+    static Vec3f* rows(const LayoutSource& s, int y0, int y1, Vec3f* out, size_t& n) {
+        n = (size_t)(y1 - y0) * s.width;
+        return out + (size_t)y0 * s.width;
+    }
+
+    static void hsvCylinder(const LayoutSource& s, int y0, int y1, Vec3f* out) {
+        using namespace color_kernels;
+        size_t n;
+        Vec3f* o = rows(s, y0, y1, out, n);
+        float h[blockSize], sat[blockSize], v[blockSize], x[blockSize], z[blockSize];
+        forEachBlock(&s.color(0, y0), n, [&](size_t first, int count, float* r, float* g, float* b) {
+            rgbToHsv(r, g, b, h, sat, v, count);
+            for (int i = 0; i < count; ++i) h[i] *= 2 * M_PI; // hue as angle in radians
+            polarToCartesian(h, sat, x, z, count);           // saturation as radius
+            for (int i = 0; i < count; ++i)
+                o[first + i] = Vec3f(x[i], (1 - v[i]) - 0.5, z[i]); // value as height
+        });
+    }
+
+    static void hslCylinder(const LayoutSource& s, int y0, int y1, Vec3f* out) {
+        using namespace color_kernels;
+        size_t n;
+        Vec3f* o = rows(s, y0, y1, out, n);
+        float h[blockSize], sat[blockSize], l[blockSize], x[blockSize], z[blockSize];
+        forEachBlock(&s.color(0, y0), n, [&](size_t first, int count, float* r, float* g, float* b) {
+            rgbToHsl(r, g, b, h, sat, l, count);
+            for (int i = 0; i < count; ++i) h[i] *= 2 * M_PI;
+            polarToCartesian(h, sat, x, z, count);
+            for (int i = 0; i < count; ++i)
+                o[first + i] = Vec3f(x[i] * 0.5, l[i] - 0.5, z[i] * 0.5);
+        });
+    }
+
+    // L* up, a* and b* across, about the size of the rgb cube
+    static void labSpace(const LayoutSource& s, int y0, int y1, Vec3f* out) {
+        using namespace color_kernels;
+        size_t n;
+        Vec3f* o = rows(s, y0, y1, out, n);
+        float L[blockSize], A[blockSize], B[blockSize];
+        forEachBlock(&s.color(0, y0), n, [&](size_t first, int count, float* r, float* g, float* b) {
+            rgbToLab(r, g, b, L, A, B, count);
+            for (int i = 0; i < count; ++i)
+                o[first + i] = Vec3f(A[i] / 200, L[i] / 100 - 0.5, B[i] / 200);
+        });
+    }
+
+    static void colorSphere(const LayoutSource& s, int y0, int y1, Vec3f* out) {
+        using namespace color_kernels;
+        float theta[blockSize], sinTheta[blockSize], cosTheta[blockSize];
+        for (int y = y0; y < y1; ++y) {
+            float phi = float(y) / s.height * M_PI;              // 纵向角度
+            float sinPhi = sin(phi), cosPhi = cos(phi);
+            for (int x0 = 0; x0 < s.width; x0 += blockSize) {
+                int count = std::min(blockSize, s.width - x0);
+                for (int i = 0; i < count; ++i)
+                    theta[i] = float(x0 + i) / s.width * 2.0f * M_PI; // 横向角度
+                sinCos(theta, sinTheta, cosTheta, count);
+
+                // 用 x 和 y 映射到球面方向, radius = brightness
+                const Color* c = &s.color(x0, y);
+                Vec3f* o = out + (size_t)y * s.width + x0;
+                for (int i = 0; i < count; ++i) {
+                    float r = (c[i].r + c[i].g + c[i].b) / 3.0f;
+                    o[i] = Vec3f(r * sinPhi * cosTheta[i], r * sinPhi * sinTheta[i], r * cosPhi);
+                }
             }
         }
-    } 
-    
+    }
 };
 
 int main() {
@@ -0,0 +1,9 @@
+#version 330
+
+in vec4 color;
+
+layout(location = 0) out vec4 fragmentColor;
+
+void main() {
+  fragmentColor = color;
+}
@@ -0,0 +1,25 @@
+#version 330
+
+// the pixel cloud morph, done here instead of on the CPU. every layout is
+// its own attribute stream; a point starts between fromPosition and
+// viaPosition (at `settled`) and eases toward toPosition the way the CPU
+// lerp does, `rate` of the remaining way per 60 Hz frame
+layout(location = 1) in vec4 vertexColor;
+layout(location = 4) in vec3 fromPosition;
+layout(location = 5) in vec3 viaPosition;
+layout(location = 6) in vec3 toPosition;
+
+uniform mat4 al_ModelViewMatrix;
+uniform mat4 al_ProjectionMatrix;
+uniform float time;     // seconds since the last layout switch
+uniform float settled;  // how far from -> via the points were at that switch
+uniform float rate;     // GpuMorph::rate
+
+out vec4 color;
+
+void main() {
+  vec3 start = mix(fromPosition, viaPosition, settled);
+  float f = 1.0 - pow(1.0 - rate, time * 60.0);
+  gl_Position = al_ProjectionMatrix * al_ModelViewMatrix * vec4(mix(start, toPosition, f), 1.0);
+  color = vertexColor;
+}
@@ -0,0 +1,156 @@
+// The pixel cloud's per-frame morph: every point eases toward its target
+//
+// Positions and targets are both plain arrays of Vec3f, i.e. flat runs of
+// floats (x0 y0 z0 x1 y1 z1 ...). A lerp treats every coordinate the same,
+// so the whole step is one straight loop over 3 * n floats with nothing to
+// gather or scatter, which the compiler turns into full-width vector code.
+// The current positions are the mesh's own vertex array, so there is no
+// second copy to keep in sync.
+//
+// MorphTiles cuts the points into tiles of 4096 and lets a tile go to sleep
+// once every coordinate in it is within epsilon of its target (it is then
+// snapped exactly onto the target). Sleeping tiles are not touched at all;
+// only tiles that moved this frame are marked dirty, so only those need to
+// go to the GPU. A new layout wakes everything up.
+//
+// The AVX2 version is the same loop (one inline body) compiled with a
+// target attribute and picked at runtime, so no -march flag is needed;
+// everything else gets the plain loop (SSE2 on x86-64, NEON on arm64).
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include "al/math/al_Vec.hpp"
+
+#include "../common/thread_pool.hpp"
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define PIXEL_MORPH_X86 1
+#endif
+
+namespace pixel_morph {
+
+#if defined(__GNUC__) || defined(__clang__)
+#define PIXEL_MORPH_INLINE inline __attribute__((always_inline))
+#else
+#define PIXEL_MORPH_INLINE inline
+#endif
+
+// current[k] += (target[k] - current[k]) * t for k in [0, count). returns
+// how many coordinates were still further than epsilon from their target.
+// the one body both versions below are compiled from
+PIXEL_MORPH_INLINE int lerp(float* __restrict current, const float* __restrict target,
+                            size_t count, float t, float epsilon) {
+    int moving = 0;
+    for (size_t k = 0; k < count; ++k) {
+        float d = target[k] - current[k];
+        moving += std::fabs(d) > epsilon;
+        current[k] += d * t;
+    }
+    return moving;
+}
+
+inline int lerpScalar(float* current, const float* target, size_t count, float t, float epsilon) {
+    return lerp(current, target, count, t, epsilon);
+}
+
+#ifdef PIXEL_MORPH_X86
+__attribute__((target("avx2,fma"))) inline int lerpAVX2(
+    float* current, const float* target, size_t count, float t, float epsilon) {
+    return lerp(current, target, count, t, epsilon);
+}
+#endif
+
+typedef int (*LerpFunction)(float*, const float*, size_t, float, float);
+
+inline LerpFunction bestLerp() {
+#ifdef PIXEL_MORPH_X86
+    static LerpFunction best = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+            return (LerpFunction)lerpAVX2;
+        return (LerpFunction)lerpScalar;
+    }();
+    return best;
+#else
+    return lerpScalar;
+#endif
+}
+
+}  // namespace pixel_morph
+
+struct MorphTiles {
+    static const int tileSize = 4096;  // points per tile
+    float epsilon = 1e-4f;  // closer than this to the target counts as arrived
+
+    // n points, all awake
+    void reset(size_t n) {
+        points = n;
+        size_t tiles = (n + tileSize - 1) / tileSize;
+        awake.assign(tiles, 1);
+        dirty.assign(tiles, 0);
+    }
+
+    // after the targets change
+    void wakeAll() { std::fill(awake.begin(), awake.end(), 1); }
+
+    bool asleep() const { return std::find(awake.begin(), awake.end(), 1) == awake.end(); }
+
+    // move every awake point a fraction t of the way to its target, split
+    // over the pool by tile. tiles that arrive are snapped and put to sleep
+    void step(std::vector<al::Vec3f>& current, const std::vector<al::Vec3f>& target,
+              float t, ThreadPool& pool) {
+        std::fill(dirty.begin(), dirty.end(), 0);
+        moving.clear();
+        for (int i = 0; i < (int)awake.size(); ++i)
+            if (awake[i]) moving.push_back(i);
+        if (moving.empty()) return;
+
+        size_t n = std::min({points, current.size(), target.size()});
+        if (n == 0) return;
+        pixel_morph::LerpFunction f = pixel_morph::bestLerp();
+        pool.parallelFor(moving.size(), [&](int begin, int end) {
+            for (int m = begin; m < end; ++m) {
+                int tile = moving[m];
+                size_t from = (size_t)tile * tileSize;
+                size_t count = std::min((size_t)tileSize, n - std::min(n, from));
+                float* c = &current[0].x + 3 * from;
+                const float* g = &target[0].x + 3 * from;
+                if (f(c, g, 3 * count, t, epsilon) == 0) {
+                    memcpy(c, g, 3 * count * sizeof(float));
+                    awake[tile] = 0;
+                }
+                dirty[tile] = 1;
+            }
+        });
+    }
+
+    // f(first point, point count) for each run of tiles that moved in the
+    // last step, neighbouring tiles merged into one run
+    template <class F>
+    void forEachDirtyRun(F f) const {
+        for (size_t tile = 0; tile < dirty.size();) {
+            if (!dirty[tile]) {
+                tile++;
+                continue;
+            }
+            size_t end = tile;
+            while (end < dirty.size() && dirty[end]) end++;
+            size_t from = tile * tileSize;
+            f(from, std::min(end * tileSize, points) - from);
+            tile = end;
+        }
+    }
+
+private:
+    size_t points = 0;
+    std::vector<char> awake;
+    std::vector<char> dirty;
+    std::vector<int> moving;  // awake tiles at the start of the step
+};
@@ -1,18 +1,18 @@
 #include "al/app/al_App.hpp"
 #include "al/math/al_Random.hpp"
 using namespace al;
-#include <fstream> // for slurp()
-#include <string> // for slurp()
+#include <string>
+#include "../common/asset_loader.hpp"
 
 Vec3f rvec() { return Vec3f(rnd::uniformS(), rnd::uniformS(), rnd::uniformS()); }
 RGB rcolor() { return RGB(rnd::uniform(), rnd::uniform(), rnd::uniform()); }
 
-std::string slurp(std::string fileName); // only a declaration
-
 class MyApp : public App {
     
     Mesh mesh;
     ShaderProgram shader;
+    AssetLoader assets;
+    bool shaderReady = false;
 
     void onCreate() override {
         mesh.primitive(Mesh::POINTS);
@@ -22,14 +22,21 @@ class MyApp : public App {
             mesh.texCoord(0.1, 0);
         }
     
-        if (! shader.compile(slurp("../point-vertex.glsl"), slurp("../point-fragment.glsl"), slurp("../point-geometry.glsl"))) {
-            printf("Shader failed to compile\n");
-            exit(1);
-        }
+        // loads in the background; recompiles whenever a shader file is saved
+        assets.watch({"../point-vertex.glsl", "../point-fragment.glsl", "../point-geometry.glsl"},
+                     [this](const std::vector<AssetLoader::Bytes>& source) {
+            shaderReady = source[0] && source[1] && source[2] && shader.compile(*source[0], *source[1], *source[2]);
+            if (!shaderReady) printf("Shader failed to compile\n");
+        });
+    }
+
+    void onAnimate(double dt) override {
+        assets.poll();
     }
 
     void onDraw(Graphics& g) override {
         g.clear(0.1);
+        if (!shaderReady) return;
         g.shader(shader);
         g.shader().uniform("pointSize", 0.1);
         g.blending(true);
@@ -57,15 +64,3 @@ class MyApp : public App {
     }
 };
 int main() { MyApp().start(); }
-
-
-std::string slurp(std::string fileName) {
-    std::fstream file(fileName);
-    std::string returnValue = "";
-    while (file.good()) {
-      std::string line;
-      getline(file, line);
-      returnValue += line + "\n";
-    }
-    return returnValue;
-  }
\ No newline at end of file
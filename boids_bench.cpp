@@ -0,0 +1,210 @@
+// Headless benchmark for the Assignment4 flock
+//
+// Runs flock.hpp (the same step Assignment4.cpp takes) without a window, on
+// synthetic flocks from a fixed seed, and prints one CSV row per
+// combination of agent count, obstacle count, mode and thread count:
+//
+//   agents,obstacles,mode,threads,steps,search_ms,rules_ms,integrate_ms,
+//   neighbors_per_agent,cache_misses_per_step,steps_per_sec
+//
+// mode "original" is the code before the spatial hash and obstacle field:
+// every agent checks every agent and every cube. "optimized" is what the
+// app runs now. The *_ms columns are per step: search is building the
+// spatial hash (and the obstacle field, which only happens once), rules is
+// the per-agent flocking pass, integrate is swapping buffers and drawing
+// new targets. neighbors_per_agent counts the other agents within
+// flockRadius at the last step. cache_misses_per_step comes from the Linux
+// perf counters and is n/a where they cannot be opened (no Linux, or
+// perf_event_paranoid too high).
+//
+// The flock is spread so that there are --density agents per unit volume
+// whatever its size, so bigger flocks are wider, not denser; obstacles are
+// scattered through the same volume.
+//
+// build (only needs the allolib headers):
+//   cmake -S . -B build && cmake --build build && ./build/boids_bench
+// or
+//   c++ -O3 -std=c++17 -pthread -I path/to/allolib/include boids_bench.cpp
+//
+// options (lists are comma separated):
+//   --agents 100,1000,10000,100000,1000000
+//   --obstacles 0,27,1000
+//   --mode original,optimized
+//   --threads 1,<cores>
+//   --steps 20          --density 0.05
+//   --budget 2e10       skip original runs needing more pair checks
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "al/math/al_Vec.hpp"
+
+#include "flock.hpp"
+
+using namespace al;
+using namespace std;
+
+struct Options {
+  vector<long long> agents = {100, 1000, 10000, 100000, 1000000};
+  vector<long long> obstacles = {0, 27, 1000};
+  vector<string> mode = {"original", "optimized"};
+  vector<long long> threads;
+  int steps = 20;
+  float density = 0.05f;
+  double budget = 2e10;
+};
+
+// hardware cache misses of this process and every thread it starts after
+// start(); -1 if the counter is not available
+struct CacheMisses {
+  int fd = -1;
+
+  void start() {
+#ifdef __linux__
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.inherit = 1;  // the pool's threads are counted too
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+  }
+
+  void enable() {
+#ifdef __linux__
+    if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+  }
+
+  long long stop() {
+    long long count = -1;
+#ifdef __linux__
+    if (fd < 0) return -1;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) count = -1;
+    close(fd);
+    fd = -1;
+#endif
+    return count;
+  }
+};
+
+static vector<string> splitList(const string &s) {
+  vector<string> out;
+  stringstream in(s);
+  string item;
+  while (getline(in, item, ',')) out.push_back(item);
+  return out;
+}
+
+static int usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [--agents 100,1000,...] [--obstacles 0,27,1000]\n"
+          "       [--mode original,optimized] [--threads 1,4] [--steps 20]\n"
+          "       [--density 0.05] [--budget 2e10]\n",
+          program);
+  return 1;
+}
+
+static vector<long long> splitNumbers(const string &s) {
+  vector<long long> out;
+  for (auto &item : splitList(s)) out.push_back((long long)atof(item.c_str()));
+  return out;
+}
+
+int main(int argc, char *argv[]) {
+  Options o;
+  o.threads = {1, (long long)thread::hardware_concurrency()};
+  if (o.threads[1] <= 1) o.threads.pop_back();
+
+  for (int a = 1; a < argc; a += 2) {
+    if (a + 1 == argc) return usage(argv[0]);  // an option without its value
+    string key = argv[a], value = argv[a + 1];
+    if (key == "--agents") o.agents = splitNumbers(value);
+    else if (key == "--obstacles") o.obstacles = splitNumbers(value);
+    else if (key == "--mode") o.mode = splitList(value);
+    else if (key == "--threads") o.threads = splitNumbers(value);
+    else if (key == "--steps") o.steps = atoi(value.c_str());
+    else if (key == "--density") o.density = atof(value.c_str());
+    else if (key == "--budget") o.budget = atof(value.c_str());
+    else {
+      fprintf(stderr, "unknown option %s\n", key.c_str());
+      return usage(argv[0]);
+    }
+  }
+
+  printf("agents,obstacles,mode,threads,steps,search_ms,rules_ms,integrate_ms,"
+         "neighbors_per_agent,cache_misses_per_step,steps_per_sec\n");
+
+  double dt = 1 / 60.0;
+  for (long long threads : o.threads) {
+    for (long long agents : o.agents) {
+      for (long long obstacles : o.obstacles) {
+        for (auto &mode : o.mode) {
+          bool original = mode == "original";
+          if (original && (double)agents * (agents + obstacles) * o.steps > o.budget) {
+            fprintf(stderr, "skipping original at %lld agents (over --budget)\n",
+                    agents);
+            continue;
+          }
+
+          // the counter has to exist before the pool starts its threads
+          CacheMisses misses;
+          misses.start();
+          ThreadPool pool(threads);
+
+          Flock flock;
+          flock.useGrid = flock.useField = !original;
+          flock.extent = 0.5f * cbrt(agents / o.density);
+          flock.restart(agents, 2022);
+          Flock scatter;  // obstacles from their own stream
+          scatter.rngState.assign(1, 2023);
+          for (int c = 0; c < obstacles; ++c)
+            flock.cubePos.push_back(scatter.randomVec3f(0, flock.extent));
+
+          ThreadPool *p = threads > 1 ? &pool : nullptr;
+          flock.step(dt, p);  // warm up: first touch, obstacle field build
+          double search = 0, rules = 0, integrate = 0;
+          misses.enable();
+          auto start = chrono::steady_clock::now();
+          for (int s = 0; s < o.steps; ++s) {
+            flock.step(dt, p);
+            search += flock.searchMs;
+            rules += flock.rulesMs;
+            integrate += flock.integrateMs;
+          }
+          double seconds =
+              chrono::duration<double>(chrono::steady_clock::now() - start).count();
+          long long missCount = misses.stop();
+
+          char missText[32] = "n/a";
+          if (missCount >= 0)
+            snprintf(missText, sizeof(missText), "%.4g", (double)missCount / o.steps);
+          printf("%lld,%lld,%s,%lld,%d,%.4g,%.4g,%.4g,%.4g,%s,%.4g\n", agents,
+                 obstacles, mode.c_str(), threads, o.steps, search / o.steps,
+                 rules / o.steps, integrate / o.steps, flock.neighborsPerAgent,
+                 missText, o.steps / seconds);
+          fflush(stdout);
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,234 @@
+// File loading off the render thread, with a cache and hot reload
+//
+// read() returns a file's bytes in one bulk read (size from stat, then a
+// single read call) and keeps them keyed by path; as long as the file's mtime
+// and size do not change, the next read() is just the cached copy.
+//
+// Everything slow can go to the loader's worker thread instead:
+//   readAsync(path, done)   the bytes, later
+//   async(work, done)       any blocking load (Image::load, Scene::import)
+//   watch(paths, changed)   the bytes of all paths now, and again every time
+//                           one of them changes on disk (checked 4x a second)
+// The callbacks do not run on the worker. They wait until the owner calls
+// poll(), once a frame from onAnimate, so they run on the render thread and
+// can touch meshes and compile shaders; only the file I/O and decoding happen
+// in the background, and an edited shader is picked up without a stall.
+//
+// POSIX (stat/open/read).
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class AssetLoader {
+ public:
+  typedef std::shared_ptr<const std::string> Bytes;  // null: could not read
+
+  AssetLoader() : worker([this] { work(); }) {}
+
+  ~AssetLoader() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quitting = true;
+    }
+    wake.notify_all();
+    worker.join();
+  }
+
+  AssetLoader(const AssetLoader&) = delete;
+  AssetLoader& operator=(const AssetLoader&) = delete;
+
+  // blocking, cached. safe from any thread
+  Bytes read(const std::string& path) {
+    Stamp stamp;
+    if (!stampOf(path, stamp)) return nullptr;
+    {
+      std::lock_guard<std::mutex> lock(cacheMutex);
+      auto hit = cache.find(path);
+      if (hit != cache.end() && hit->second.stamp == stamp) return hit->second.bytes;
+    }
+    Bytes bytes = readFile(path, stamp.size);
+    if (!bytes) return nullptr;
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    cache[path] = Entry{stamp, bytes};
+    return bytes;
+  }
+
+  // the text of a file, "" if it could not be read
+  std::string text(const std::string& path) {
+    Bytes bytes = read(path);
+    return bytes ? *bytes : std::string();
+  }
+
+  void readAsync(const std::string& path, std::function<void(Bytes)> done) {
+    auto result = std::make_shared<Bytes>();
+    async([this, path, result] { *result = read(path); },
+          [done, result] { done(*result); });
+  }
+
+  // work() on the worker thread, then done() at the next poll()
+  void async(std::function<void()> work, std::function<void()> done) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push_back([this, work, done] {
+        work();
+        finish(done);
+      });
+    }
+    wake.notify_all();
+  }
+
+  // changed() gets the bytes of every path, in order: once as soon as they
+  // are loaded and again whenever any of them is saved
+  void watch(const std::vector<std::string>& paths,
+             std::function<void(const std::vector<Bytes>&)> changed) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      Watch w;
+      w.paths = paths;
+      w.stamps.resize(paths.size());
+      w.changed = changed;
+      watches.push_back(w);
+      lastCheck = {};  // look right away
+    }
+    wake.notify_all();
+  }
+
+  // run the callbacks of everything that finished since last time
+  void poll() {
+    std::vector<std::function<void()>> ready;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ready.swap(finished);
+    }
+    for (auto& f : ready) f();
+  }
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Stamp {
+    long long mtime = -1;  // seconds
+    long long mtimeNs = -1;  // and nanoseconds, so two saves in one second differ
+    long long size = -1;
+    bool operator==(const Stamp& o) const {
+      return mtime == o.mtime && mtimeNs == o.mtimeNs && size == o.size;
+    }
+    bool operator!=(const Stamp& o) const { return !(*this == o); }
+  };
+  struct Entry {
+    Stamp stamp;
+    Bytes bytes;
+  };
+  struct Watch {
+    std::vector<std::string> paths;
+    std::vector<Stamp> stamps;
+    std::function<void(const std::vector<Bytes>&)> changed;
+  };
+
+  static bool stampOf(const std::string& path, Stamp& stamp) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return false;
+#ifdef __APPLE__
+    stamp.mtime = (long long)info.st_mtimespec.tv_sec;
+    stamp.mtimeNs = (long long)info.st_mtimespec.tv_nsec;
+#else
+    stamp.mtime = (long long)info.st_mtim.tv_sec;
+    stamp.mtimeNs = (long long)info.st_mtim.tv_nsec;
+#endif
+    stamp.size = (long long)info.st_size;
+    return true;
+  }
+
+  static Bytes readFile(const std::string& path, long long size) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    auto bytes = std::make_shared<std::string>(size, '\0');
+    long long got = 0;
+    while (got < size) {
+      ssize_t n = ::read(fd, &(*bytes)[got], size - got);
+      if (n <= 0) break;
+      got += n;
+    }
+    close(fd);
+    bytes->resize(got);  // it shrank while we read; the next stat will notice
+    return bytes;
+  }
+
+  void finish(std::function<void()> done) {
+    std::lock_guard<std::mutex> lock(mutex);
+    finished.push_back(done);
+  }
+
+  void work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!quitting) {
+      if (!jobs.empty()) {
+        auto job = jobs.front();
+        jobs.pop_front();
+        lock.unlock();
+        job();
+        lock.lock();
+        continue;
+      }
+      if (!watches.empty() && Clock::now() - lastCheck >= std::chrono::milliseconds(250)) {
+        lastCheck = Clock::now();
+        // copy: read() is slow and other threads may add watches meanwhile
+        std::vector<Watch> current = watches;
+        lock.unlock();
+        for (int w = 0; w < (int)current.size(); ++w) check(current[w], w);
+        lock.lock();
+        continue;
+      }
+      if (watches.empty())
+        wake.wait(lock);
+      else
+        wake.wait_for(lock, std::chrono::milliseconds(250));
+    }
+  }
+
+  void check(Watch w, int index) {
+    bool changed = false;
+    for (int i = 0; i < (int)w.paths.size(); ++i) {
+      Stamp stamp;
+      stampOf(w.paths[i], stamp);  // a missing file stays at -1, -1
+      if (stamp != w.stamps[i]) changed = true;
+      w.stamps[i] = stamp;
+    }
+    if (!changed) return;
+    auto bytes = std::make_shared<std::vector<Bytes>>();
+    for (auto& path : w.paths) bytes->push_back(read(path));
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      watches[index].stamps = w.stamps;
+    }
+    auto callback = w.changed;
+    finish([callback, bytes] { callback(*bytes); });
+  }
+
+  std::mutex mutex;  // jobs, watches, finished
+  std::condition_variable wake;
+  std::deque<std::function<void()>> jobs;
+  std::vector<Watch> watches;
+  std::vector<std::function<void()>> finished;
+  Clock::time_point lastCheck;
+  bool quitting = false;
+
+  std::mutex cacheMutex;
+  std::map<std::string, Entry> cache;
+
+  std::thread worker;  // last, so it starts after everything above exists
+};
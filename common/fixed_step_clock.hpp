@@ -0,0 +1,22 @@
+// Turns a frame's dt into a whole number of fixed simulation steps
+//
+// The physics then does not change with the frame rate; whatever is left
+// over waits in the accumulator for the next frame.
+
+#pragma once
+
+#include <algorithm>
+
+struct FixedStepClock {
+  double accumulator = 0;
+  double maxLag = 0.25;  // after a long stall, drop time instead of catching up
+
+  // how many steps of `interval` seconds are due after `dt` more seconds
+  int advance(double dt, double interval, int maxSteps) {
+    accumulator = std::min(accumulator + dt, maxLag);
+    int steps = std::min((int)(accumulator / interval), maxSteps);
+    accumulator -= steps * interval;
+    if (steps == maxSteps) accumulator = std::min(accumulator, interval);
+    return steps;
+  }
+};
@@ -0,0 +1,48 @@
+// Runs a simulation tick on its own thread
+//
+// tick(dt) is called over and over with the real time since the last call,
+// at most `hz` times a second; if a tick takes longer than 1/hz the next one
+// starts right away. The tick decides how much simulating that dt is worth
+// (e.g. through a FixedStepClock) and publishes its results itself, usually
+// through a TripleBuffer, so nothing here waits on the render thread.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+class SimThread {
+ public:
+  ~SimThread() { stop(); }
+
+  bool running() const { return thread.joinable(); }
+
+  void start(std::function<void(double)> tick, double hz = 240) {
+    stop();
+    quitting = false;
+    thread = std::thread([this, tick, hz] {
+      typedef std::chrono::steady_clock Clock;
+      auto period = std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(1 / hz));
+      auto last = Clock::now();
+      while (!quitting) {
+        auto now = Clock::now();
+        tick(std::chrono::duration<double>(now - last).count());
+        last = now;
+        std::this_thread::sleep_until(now + period);
+      }
+    });
+  }
+
+  void stop() {
+    if (!running()) return;
+    quitting = true;
+    thread.join();
+  }
+
+ private:
+  std::thread thread;
+  std::atomic<bool> quitting{false};
+};
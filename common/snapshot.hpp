@@ -0,0 +1,85 @@
+// Binary snapshots of simulation state
+//
+// SnapshotWriter appends plain values and vectors of plain values to a byte
+// buffer; SnapshotReader takes them out again in the same order. A vector is
+// its length and then its raw bytes, so saving a flock is a few memcpys and
+// restoring it does not allocate when the vectors already have the room.
+// saveSnapshot()/loadSnapshot() move a buffer to and from a file. Native endianness, meant
+// for replaying a run on the same machine, not for archiving. T has to be
+// plain data (no pointers inside).
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct SnapshotWriter {
+  std::vector<char>& out;
+  explicit SnapshotWriter(std::vector<char>& buffer) : out(buffer) { out.clear(); }
+
+  template <class T>
+  void put(const T& value) {
+    const char* p = (const char*)&value;
+    out.insert(out.end(), p, p + sizeof(T));
+  }
+
+  template <class T>
+  void put(const std::vector<T>& values) {
+    put((uint64_t)values.size());
+    const char* p = (const char*)values.data();
+    out.insert(out.end(), p, p + values.size() * sizeof(T));
+  }
+};
+
+struct SnapshotReader {
+  const std::vector<char>& in;
+  size_t at = 0;
+  bool ok = true;  // false once anything was missing
+  explicit SnapshotReader(const std::vector<char>& buffer) : in(buffer) {}
+
+  template <class T>
+  void get(T& value) {
+    if (!ok || at + sizeof(T) > in.size()) {
+      ok = false;
+      return;
+    }
+    memcpy((void*)&value, in.data() + at, sizeof(T));
+    at += sizeof(T);
+  }
+
+  template <class T>
+  void get(std::vector<T>& values) {
+    uint64_t n = 0;
+    get(n);
+    if (!ok || n > (in.size() - at) / sizeof(T)) {  // (a corrupt n must not overflow)
+      ok = false;
+      return;
+    }
+    values.resize(n);
+    memcpy((void*)values.data(), in.data() + at, n * sizeof(T));
+    at += n * sizeof(T);
+  }
+};
+
+inline bool saveSnapshot(const std::string& path, const std::vector<char>& buffer) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file) return false;
+  bool ok = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+  fclose(file);
+  return ok;
+}
+
+inline bool loadSnapshot(const std::string& path, std::vector<char>& buffer) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file) return false;
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  buffer.resize(size > 0 ? size : 0);
+  bool ok = fread(buffer.data(), 1, buffer.size(), file) == buffer.size();
+  fclose(file);
+  return ok;
+}
@@ -0,0 +1,116 @@
+// Small fork-join thread pool for the simulations
+//
+// The workers are started once and sleep between calls. run() hands out task
+// numbers 0..tasks-1 and returns when every task is done; the calling thread
+// works too, so a pool of size 1 is just a plain loop. Which thread runs a
+// task is not fixed, so anything that has to come out the same every time
+// should be keyed on the task number, never on the thread.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+ public:
+  // 0 threads: one per core
+  explicit ThreadPool(int threads = 0) {
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int t = 1; t < threads; ++t) workers.emplace_back([this] { work(); });
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quitting = true;
+    }
+    wake.notify_all();
+    for (auto& w : workers) w.join();
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // threads that run tasks, counting the caller
+  int size() const { return workers.size() + 1; }
+
+  // task(t) for every t in [0, tasks), in parallel. blocks until all are done
+  void run(int tasks, const std::function<void(int)>& task) {
+    if (tasks <= 0) return;
+    if (workers.empty() || tasks == 1) {
+      for (int t = 0; t < tasks; ++t) task(t);
+      return;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    // a worker that woke up late for the last job may still be looking at
+    // the old counters; let it leave before they are reset
+    done.wait(lock, [this] { return busy == 0; });
+    job = &task;
+    jobTasks = tasks;
+    unfinished = tasks;
+    next = 0;
+    generation++;
+    lock.unlock();
+    wake.notify_all();
+    drain();
+    lock.lock();
+    done.wait(lock, [this] { return unfinished == 0; });
+  }
+
+  // f(begin, end) over `parts` contiguous slices of [0, n). by default one
+  // slice per thread; pass parts yourself when the split has to stay the same
+  // no matter how many threads there are
+  void parallelFor(int n, const std::function<void(int, int)>& f,
+                   int parts = 0) {
+    if (parts <= 0) parts = size();
+    parts = std::max(1, std::min(parts, n));
+    run(parts, [&](int p) {
+      f((long long)n * p / parts, (long long)n * (p + 1) / parts);
+    });
+  }
+
+ private:
+  void work() {
+    long seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      wake.wait(lock, [&] { return quitting || generation != seen; });
+      if (quitting) return;
+      seen = generation;
+      busy++;
+      lock.unlock();
+      drain();
+      lock.lock();
+      if (--busy == 0) done.notify_all();
+    }
+  }
+
+  // grab tasks until there are none left
+  void drain() {
+    while (true) {
+      int t = next.fetch_add(1);
+      if (t >= jobTasks) return;
+      (*job)(t);
+      if (unfinished.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lock(mutex);
+        done.notify_all();
+      }
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  const std::function<void(int)>* job = nullptr;
+  int jobTasks = 0;
+  std::atomic<int> next{0};
+  std::atomic<int> unfinished{0};
+  int busy = 0;  // workers inside drain()
+  long generation = 0;
+  bool quitting = false;
+};
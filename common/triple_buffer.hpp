@@ -0,0 +1,39 @@
+// Lock-free triple buffer: one writer thread, one reader thread
+//
+// The writer fills writeBuffer() and publish()es it; the reader calls
+// update() and then looks at readBuffer(). Three copies means neither side
+// ever waits: the writer always has a buffer nobody reads, the reader always
+// has the newest complete one, and the third sits in the middle as the hand-
+// off. If the writer publishes twice before the reader looks, the older one
+// is simply dropped.
+//
+// The buffers are reused, so a vector in T keeps its capacity from one
+// snapshot to the next and steady-state publishing does not allocate.
+
+#pragma once
+
+#include <atomic>
+
+template <class T>
+class TripleBuffer {
+ public:
+  // writer side
+  T& writeBuffer() { return buffers[back]; }
+  void publish() { back = middle.exchange(back | FRESH) & INDEX; }
+
+  // reader side. true if a newer snapshot arrived since the last call
+  bool update() {
+    if (!(middle.load() & FRESH)) return false;
+    front = middle.exchange(front) & INDEX;
+    return true;
+  }
+  const T& readBuffer() const { return buffers[front]; }
+  T& readBuffer() { return buffers[front]; }
+
+ private:
+  enum { INDEX = 3, FRESH = 4 };
+  T buffers[3];
+  int back = 0;               // writer's
+  std::atomic<int> middle{1};  // index, plus FRESH when the writer left it there
+  int front = 2;              // reader's
+};
@@ -0,0 +1,312 @@
+// The Assignment4 flock, without the window
+//
+// All the state is arrays indexed by agent. step() runs the same rules the
+// app always had (seek a target, flock toward and align with neighbors
+// between 1 and flockRadius away, push off anyone closer than 1, steer
+// away from cubes within 1.5) in three timed phases:
+//   search     rebuild the spatial hash, and the obstacle field if the
+//              cubes changed
+//   rules      every agent reads position/velocity and writes
+//              nextPosition/nextVelocity; in parallel when given a pool, and
+//              the same result for any number of threads
+//   integrate  swap the buffers, draw new targets, advance the goal timer
+// useGrid/useField switch back to the original loops over all agents and
+// all cubes, for comparison. Random draws come from one splitmix64 stream
+// per agent, so a seed (or a snapshot) replays exactly.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "al/math/al_Vec.hpp"
+
+#include "obstacle_field.hpp"
+#include "spatial_hash.hpp"
+#include "common/snapshot.hpp"
+#include "common/thread_pool.hpp"
+
+struct Flock {
+  float flockCentering = 1.2;
+  float alignStrength = 0.4;
+  float cubeAvoidance = 0.1;
+  float goalInterval = 3.0f; // everyone gets a new target this often
+  float flockRadius = 4.0;   // neighbors further away are ignored
+  float speed = 0.05;        // distance per step
+  float extent = 5;          // agents start and wander within this of the origin
+  bool useGrid = true;   // false: every agent checks every other one
+  bool useField = true;  // false: every agent checks every cube
+
+  // size, color, species, sex, age, etc.
+  std::vector<al::Vec3f> position;
+  std::vector<al::Vec3f> velocity;
+  std::vector<al::Vec3f> target;
+  std::vector<float> size; // (0, 1]
+  std::vector<int> interest; // (0, 1]
+  std::vector<uint64_t> rngState; // each agent draws from its own stream
+  std::vector<al::Vec3f> cubePos;
+  float goalTimer = 0;       // elapsed time since last update
+  long long stepCount = 0;
+
+  // last step
+  double searchMs = 0, rulesMs = 0, integrateMs = 0;
+  float neighborsPerAgent = 0; // other agents within flockRadius, on average
+
+  // a new flock of `count` agents drawn from the given seed
+  void restart(int count, uint64_t seed) {
+    position.clear();
+    velocity.clear();
+    target.clear();
+    size.clear();
+    interest.clear();
+    rngState.clear();
+    for (int i = 0; i < count; ++i) {
+      // hashed, not seed * G + i: random() adds G every draw, so that would
+      // make seed s + 1 the same streams as seed s one draw later
+      rngState.push_back(mix(mix(seed) ^ (uint64_t)i));
+      position.push_back(randomVec3f(i, extent));
+      velocity.push_back(al::Vec3f(0)); // 初始速度为0
+      target.push_back(randomVec3f(i, extent)); // 给每个agent一个初始目标
+      size.push_back(0.05 + 0.95 * (random(i) * 0.5 + 0.5)); // (0.05, 1]
+      interest.push_back(-1);
+    }
+    goalTimer = 0;
+    stepCount = 0;
+  }
+
+  // splitmix64's output function
+  static uint64_t mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+
+  // splitmix64 on agent i's stream, as a float in [-1, 1)
+  float random(int i) {
+    uint64_t z = mix(rngState[i] += 0x9e3779b97f4a7c15ull);
+    return (z >> 40) * (2.0f / (1 << 24)) - 1;
+  }
+
+  al::Vec3f randomVec3f(int i, float scale) {
+    float x = random(i), y = random(i), z = random(i);
+    return al::Vec3f(x, y, z) * scale;
+  }
+
+  // pool may be null: everything on this thread
+  void step(double dt, ThreadPool* pool) {
+    typedef std::chrono::steady_clock Clock;
+    auto ms = [](Clock::time_point a, Clock::time_point b) {
+      return std::chrono::duration<double, std::milli>(b - a).count();
+    };
+    auto t0 = Clock::now();
+
+    // only agents in nearby cells can be within flockRadius
+    if (useGrid) grid.build(position, flockRadius);
+    if (useField) field.update(cubePos); // only rebuilds when the cubes changed
+    auto t1 = Clock::now();
+
+    int n = position.size();
+    nextPosition.resize(n);
+    nextVelocity.resize(n);
+    reachedTarget.resize(n);
+    std::atomic<long long> neighbors{0};
+    auto rules = [&](int begin, int end) { neighbors += updateAgents(begin, end); };
+    if (pool)
+      pool->parallelFor(n, rules);
+    else
+      rules(0, n);
+    auto t2 = Clock::now();
+
+    position.swap(nextPosition);
+    velocity.swap(nextVelocity);
+    for (int i = 0; i < n; ++i)
+      if (reachedTarget[i]) target[i] = randomVec3f(i, extent);
+
+    goalTimer += dt;
+    if (goalTimer > goalInterval) {
+      goalTimer = 0;
+
+      // assign each agent a new target
+      for (int i = 0; i < (int)target.size(); ++i) {
+        target[i] = randomVec3f(i, extent * 1.6); // or larger like randomVec3f(i, 10)
+      }
+    }
+    stepCount++;
+    auto t3 = Clock::now();
+
+    searchMs = ms(t0, t1);
+    rulesMs = ms(t1, t2);
+    integrateMs = ms(t2, t3);
+    neighborsPerAgent = n > 0 ? (float)neighbors / n : 0;
+  }
+
+  // everything a replay needs, as plain arrays
+  void save(SnapshotWriter& out) const {
+    out.put(stepCount);
+    out.put(goalTimer);
+    out.put(position);
+    out.put(velocity);
+    out.put(target);
+    out.put(size);
+    out.put(interest);
+    out.put(rngState);
+  }
+
+  // a save() read back but not yet put into a flock, so that a snapshot
+  // that turns out to be cut short or corrupt leaves the flock as it was
+  struct Saved {
+    long long stepCount = 0;
+    float goalTimer = 0;
+    std::vector<al::Vec3f> position, velocity, target;
+    std::vector<float> size;
+    std::vector<int> interest;
+    std::vector<uint64_t> rngState;
+  };
+
+  // false (and in.ok false) if anything was missing or the arrays do not
+  // all have one entry per agent
+  static bool read(SnapshotReader& in, Saved& s) {
+    in.get(s.stepCount);
+    in.get(s.goalTimer);
+    in.get(s.position);
+    in.get(s.velocity);
+    in.get(s.target);
+    in.get(s.size);
+    in.get(s.interest);
+    in.get(s.rngState);
+    size_t n = s.position.size();
+    if (s.velocity.size() != n || s.target.size() != n || s.size.size() != n ||
+        s.interest.size() != n || s.rngState.size() != n)
+      in.ok = false;
+    return in.ok;
+  }
+
+  // take over what read() got
+  void restore(Saved& s) {
+    stepCount = s.stepCount;
+    goalTimer = s.goalTimer;
+    position.swap(s.position);
+    velocity.swap(s.velocity);
+    target.swap(s.target);
+    size.swap(s.size);
+    interest.swap(s.interest);
+    rngState.swap(s.rngState);
+  }
+
+  // read() and restore() in one, for a snapshot with nothing after the flock
+  bool load(SnapshotReader& in) {
+    Saved s;
+    if (!read(in, s)) return false;
+    restore(s);
+    return true;
+  }
+
+ private:
+  // a step reads position/velocity and writes next*, then they swap, so no
+  // agent sees another's new position and the order agents run in does not
+  // matter; they can all run at once
+  std::vector<al::Vec3f> nextPosition;
+  std::vector<al::Vec3f> nextVelocity;
+  std::vector<char> reachedTarget;  // new targets are drawn after the step
+  SpatialHash grid;
+  ObstacleField field; // cube avoidance, precomputed around cubePos
+
+  template <class F>
+  void forEachCandidate(const al::Vec3f& pos, F f) const {
+    if (useGrid)
+      grid.forEachNear(pos, f);
+    else
+      for (int j = 0; j < (int)position.size(); ++j) f(j);
+  }
+
+  al::Vec3f cubePush(const al::Vec3f& pos) const {
+    if (useField) return field.push(pos); // sum over cubes within 1.5
+    al::Vec3f cubeRepel(0);
+    for (int c = 0; c < (int)cubePos.size(); ++c) {
+      al::Vec3f diff = pos - cubePos[c];
+      float d = diff.mag();
+      if (d < 1.5 && d > 0.001) {
+        cubeRepel += diff.normalize() / d;
+      }
+    }
+    return cubeRepel;
+  }
+
+  // the flocking rules for agents [begin, end), from position/velocity into
+  // nextPosition/nextVelocity. touches nothing else another range writes.
+  // returns how many neighbors within flockRadius they saw
+  long long updateAgents(int begin, int end) {
+    long long seen = 0;
+    for (int i = begin; i < end; ++i) {
+      al::Vec3f pos = position[i];
+      al::Vec3f dir(0);
+
+      // ---------- Wander (seek random target) ----------
+      al::Vec3f seek = target[i] - pos;
+      float dist = seek.mag();
+      reachedTarget[i] = dist < 0.1; // new target after the step
+      if (dist >= 0.1) {
+        seek.normalize();
+        dir += seek;
+      }
+
+      // ---------- Flock Centering ----------
+      al::Vec3f center(0);
+      al::Vec3f align(0);
+      al::Vec3f repel(0); // agent-agent avoidance
+      int neighborCount = 0;
+
+      forEachCandidate(pos, [&](int j) {
+        if (i == j) return;
+        al::Vec3f diff = position[j] - pos;
+        float d = diff.mag();
+        if (d < flockRadius) seen++;
+
+        // Flock only if not too close
+        if (d > 1.0 && d < flockRadius) {
+          center += position[j];
+          align += velocity[j];
+          neighborCount++;
+        }
+
+        // Repel if too close
+        if (d < 1.0 && d > 0.001) {
+          repel -= diff.normalize() / d; // repel direction: away
+        }
+      });
+
+      if (neighborCount > 0) {
+        center /= neighborCount;
+        al::Vec3f centerDir = (center - pos).normalize();
+        al::Vec3f alignDir = (align / neighborCount).normalize();
+        dir += centerDir * flockCentering;
+        dir += alignDir * alignStrength;
+      }
+
+      // Add agent-agent avoidance
+      if (repel.mag() > 0.001) {
+        repel.normalize();
+        dir += repel * cubeAvoidance;
+      }
+
+      // ---------- Cube Avoidance ----------
+      al::Vec3f cubeRepel = cubePush(pos);
+      if (cubeRepel.mag() > 0.001) {
+        cubeRepel.normalize();
+        dir += cubeRepel * cubeAvoidance;
+      }
+
+      // ---------- Final Move ----------
+      nextPosition[i] = pos;
+      nextVelocity[i] = velocity[i];
+      if (dir.mag() > 0.001) {
+        dir.normalize();
+        nextVelocity[i] = dir * speed;
+        nextPosition[i] = pos + nextVelocity[i];
+      }
+    }
+    return seen;
+  }
+};
@@ -0,0 +1,127 @@
+// One mesh drawn many times with a single draw call
+//
+// Instead of push/translate/rotate/scale/draw/pop for every agent, each
+// instance is two vec4 in GPU buffers: position + uniform scale, and a
+// rotation quaternion (x, y, z, w). The vertex shader below places every
+// copy and does the lighting the fixed allolib lights did for the boids (one
+// point light, ambient, a bit of specular), in world space. set() uploads
+// all instances at once; draw() is one glDraw*Instanced.
+//
+// attribute locations 0 (position) and 3 (normal) are allolib's mesh
+// layout; the instance data goes in 4 and 5.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "al/graphics/al_BufferObject.hpp"
+#include "al/graphics/al_Graphics.hpp"
+#include "al/graphics/al_OpenGL.hpp"
+#include "al/graphics/al_VAOMesh.hpp"
+#include "al/math/al_Vec.hpp"
+
+struct InstancedMesh {
+  al::VAOMesh mesh;
+  int count = 0;
+
+  // call once there is a GL context (onCreate)
+  void init(const al::Mesh& shape) {
+    static_cast<al::Mesh&>(mesh) = shape;
+    if (mesh.normals().empty()) mesh.generateNormals();  // addCube has none
+    mesh.update();
+    for (auto* b : {&offsets, &rotations}) {
+      b->bufferType(GL_ARRAY_BUFFER);
+      b->usage(GL_DYNAMIC_DRAW);
+      b->create();
+    }
+    mesh.vao().bind();
+    mesh.vao().enableAttrib(4);
+    mesh.vao().attribPointer(4, offsets, 4);
+    glVertexAttribDivisor(4, 1);
+    mesh.vao().enableAttrib(5);
+    mesh.vao().attribPointer(5, rotations, 4);
+    glVertexAttribDivisor(5, 1);
+    mesh.vao().unbind();
+  }
+
+  // offsetScale[i] = (x, y, z, scale), rotation[i] = quaternion (x, y, z, w)
+  void set(const std::vector<al::Vec4f>& offsetScale,
+           const std::vector<al::Vec4f>& rotation) {
+    count = offsetScale.size();
+    offsets.bind();
+    offsets.data(count * sizeof(al::Vec4f), offsetScale.data());
+    rotations.bind();
+    rotations.data(count * sizeof(al::Vec4f), rotation.data());
+    rotations.unbind();
+  }
+
+  // with shader() (or one like it) bound on g
+  void draw(al::Graphics& g) {
+    if (count == 0) return;
+    g.update();  // push the view/projection matrices into the shader
+    mesh.vao().bind();
+    if (mesh.indices().empty())
+      glDrawArraysInstanced(mesh.primitive(), 0, mesh.vertices().size(), count);
+    else {
+      // the same as VAOMesh's own draw: the index buffer is bound here
+      // rather than trusted to still be attached to the VAO
+      mesh.indexBuffer().bind();
+      glDrawElementsInstanced(mesh.primitive(), mesh.indices().size(),
+                              GL_UNSIGNED_INT, 0, count);
+    }
+    mesh.vao().unbind();
+  }
+
+  static std::string vertexShader() {
+    return R"(
+#version 330
+uniform mat4 al_ModelViewMatrix;
+uniform mat4 al_ProjectionMatrix;
+layout (location = 0) in vec3 position;
+layout (location = 3) in vec3 normal;
+layout (location = 4) in vec4 offsetScale;
+layout (location = 5) in vec4 rotation;
+out vec3 worldPosition;
+out vec3 worldNormal;
+
+vec3 rotate(vec4 q, vec3 v) {
+  return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main() {
+  vec3 p = rotate(rotation, position * offsetScale.w) + offsetScale.xyz;
+  worldPosition = p;
+  worldNormal = rotate(rotation, normal);
+  gl_Position = al_ProjectionMatrix * al_ModelViewMatrix * vec4(p, 1.0);
+}
+)";
+  }
+
+  static std::string fragmentShader() {
+    return R"(
+#version 330
+uniform vec3 lightPosition;
+uniform vec3 eyePosition;
+uniform vec3 lightColor;
+uniform float ambient;
+uniform float specular;
+uniform float shininess;
+in vec3 worldPosition;
+in vec3 worldNormal;
+out vec4 fragColor;
+
+void main() {
+  vec3 n = normalize(worldNormal);
+  vec3 l = normalize(lightPosition - worldPosition);
+  vec3 h = normalize(l + normalize(eyePosition - worldPosition));
+  vec3 c = vec3(ambient) + lightColor * max(dot(n, l), 0.0) +
+           lightColor * specular * pow(max(dot(n, h), 0.0), shininess);
+  fragColor = vec4(c, 1.0);
+}
+)";
+  }
+
+ private:
+  al::BufferObject offsets, rotations;
+};
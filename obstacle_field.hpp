@@ -0,0 +1,137 @@
+// Precomputed obstacle avoidance for the boids
+//
+// The avoidance push at a point is the sum over nearby obstacles of
+// (p - c) / |p - c|^2, for every obstacle closer than `range`. Instead of
+// looping over all obstacles for every agent every step, the space around
+// the obstacles is cut into cells once, and each cell keeps the list of
+// obstacles that can be within range of some point in it. At runtime a
+// push is one cell lookup and the exact sum over that short list, in the
+// same order as the full loop, so the result is the same to the last bit.
+// (An interpolated grid of the sum itself was tried first; the hard cutoff
+// at `range` and the 1/d growth near an obstacle put it tens of degrees
+// off in places.) update() rebuilds the cells only when the obstacle list
+// actually changed. Outside the cells nothing is in range, so the push is
+// zero there.
+//
+// The cells are `spacing` wide unless that would take more than maxCells;
+// then they are made coarser, which only lengthens the lists (the sum is
+// still exact), and a message says so.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "al/math/al_Vec.hpp"
+
+struct ObstacleField {
+  float range = 1.5;     // obstacles further away do not push
+  float spacing = 0.75;  // cell size
+  size_t maxCells = 1 << 22;
+
+  // rebuild if the obstacles moved, appeared or went away. true if it did
+  bool update(const std::vector<al::Vec3f>& obstacles) {
+    if (built && obstacles == source) return false;
+    build(obstacles);
+    return true;
+  }
+
+  void build(const std::vector<al::Vec3f>& obstacles) {
+    source = obstacles;
+    built = true;
+    cellStart.clear();
+    items.clear();
+    if (obstacles.empty()) return;
+
+    lo = hi = obstacles[0];
+    for (auto& c : obstacles)
+      for (int k = 0; k < 3; ++k) {
+        lo[k] = std::min(lo[k], c[k]);
+        hi[k] = std::max(hi[k], c[k]);
+      }
+    lo -= al::Vec3f(range);
+    hi += al::Vec3f(range);
+    step = spacing;
+    while (true) {
+      for (int k = 0; k < 3; ++k) dim[k] = std::max(1, (int)std::ceil((hi[k] - lo[k]) / step));
+      if ((size_t)dim[0] * dim[1] * dim[2] <= maxCells) break;
+      step *= 2;
+    }
+    if (step != spacing)
+      fprintf(stderr, "obstacle field: %g wide cells instead of %g (over maxCells)\n", step, spacing);
+
+    // each obstacle goes into every cell it can reach; counted first, then
+    // filled, obstacle by obstacle so every list stays in obstacle order
+    size_t cells = (size_t)dim[0] * dim[1] * dim[2];
+    cellStart.assign(cells + 1, 0);
+    forEachReach(obstacles, [&](size_t cell, int) { cellStart[cell + 1]++; });
+    for (size_t i = 0; i < cells; ++i) cellStart[i + 1] += cellStart[i];
+    items.resize(cellStart[cells]);
+    std::vector<uint32_t> fill(cellStart.begin(), cellStart.end() - 1);
+    forEachReach(obstacles, [&](size_t cell, int c) { items[fill[cell]++] = c; });
+  }
+
+  // the summed push at p
+  al::Vec3f push(const al::Vec3f& p) const {
+    al::Vec3f sum(0);
+    if (cellStart.empty()) return sum;
+    int i[3];
+    for (int k = 0; k < 3; ++k) {
+      float g = (p[k] - lo[k]) / step;
+      if (!(g >= 0 && g < dim[k])) return sum;  // out of range of everything
+      i[k] = (int)g;
+    }
+    size_t cell = index(i[0], i[1], i[2]);
+    for (uint32_t n = cellStart[cell]; n < cellStart[cell + 1]; ++n) {
+      al::Vec3f diff = p - source[items[n]];
+      float d = diff.mag();
+      if (d < range && d > 0.001) sum += diff.normalize() / d;
+    }
+    return sum;
+  }
+
+ private:
+  std::vector<al::Vec3f> source;
+  bool built = false;
+  std::vector<uint32_t> cellStart;  // cell i's obstacles are items[cellStart[i], cellStart[i + 1])
+  std::vector<uint32_t> items;
+  al::Vec3f lo, hi;
+  float step = 0.75;
+  int dim[3] = {0, 0, 0};
+
+  size_t index(int x, int y, int z) const {
+    return x + (size_t)dim[0] * (y + (size_t)dim[1] * z);
+  }
+
+  // f(cell, obstacle) for every cell with a point closer than range to the
+  // obstacle
+  template <class F>
+  void forEachReach(const std::vector<al::Vec3f>& obstacles, F f) const {
+    for (int c = 0; c < (int)obstacles.size(); ++c) {
+      const al::Vec3f& o = obstacles[c];
+      int from[3], to[3];
+      for (int k = 0; k < 3; ++k) {
+        from[k] = std::max(0, (int)std::floor((o[k] - range - lo[k]) / step));
+        to[k] = std::min(dim[k] - 1, (int)std::floor((o[k] + range - lo[k]) / step));
+      }
+      for (int z = from[2]; z <= to[2]; ++z)
+        for (int y = from[1]; y <= to[1]; ++y)
+          for (int x = from[0]; x <= to[0]; ++x) {
+            // distance from the obstacle to the nearest point of the cell
+            int cellIndex[3] = {x, y, z};
+            float d2 = 0;
+            for (int k = 0; k < 3; ++k) {
+              float a = lo[k] + cellIndex[k] * step, b = a + step;
+              float gap = std::max({a - o[k], o[k] - b, 0.0f});
+              d2 += gap * gap;
+            }
+            // (a little slack: a point on a cell's edge may be looked up in
+            // either cell)
+            if (d2 < range * range * 1.001f) f(index(x, y, z), c);
+          }
+    }
+  }
+};
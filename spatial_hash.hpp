@@ -0,0 +1,80 @@
+// Spatial hash for the boids neighbor search
+//
+// Space is cut into cubes as wide as the flocking radius, and each cube is
+// hashed into a table of buckets (at least twice as many as agents, so most
+// buckets hold one cube). build() counting-sorts the agents by bucket every
+// step; forEachNear() then visits the agents in the 27 cubes around a point,
+// which includes everyone within one cell width of it. Space is not bounded:
+// agents that wander far off just hash somewhere else.
+//
+// Cubes that share a bucket come along too, so callers still check the
+// distance, exactly like they did over the whole flock.
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "al/math/al_Vec.hpp"
+
+struct SpatialHash {
+  float cellSize = 4;
+  std::vector<int> bucketStart;  // agents of bucket b are order[bucketStart[b]..bucketStart[b+1])
+  std::vector<int> order;
+  std::vector<int> bucketOf;
+
+  void build(const std::vector<al::Vec3f>& position, float size) {
+    int n = position.size();
+    cellSize = size;
+    int buckets = 64;
+    while (buckets < 2 * n) buckets *= 2;
+    mask = buckets - 1;
+
+    // counting sort by bucket
+    order.resize(n);
+    bucketOf.resize(n);
+    bucketStart.assign(buckets + 1, 0);
+    for (int i = 0; i < n; ++i) {
+      bucketOf[i] = bucket(cell(position[i].x), cell(position[i].y),
+                           cell(position[i].z));
+      bucketStart[bucketOf[i] + 1]++;
+    }
+    for (int b = 0; b < buckets; ++b) bucketStart[b + 1] += bucketStart[b];
+    cursor.assign(bucketStart.begin(), bucketStart.end() - 1);
+    for (int i = 0; i < n; ++i) order[cursor[bucketOf[i]]++] = i;
+  }
+
+  // f(j) for every agent j in the cubes around p (p's own agent included)
+  template <class F>
+  void forEachNear(const al::Vec3f& p, F f) const {
+    int cx = cell(p.x), cy = cell(p.y), cz = cell(p.z);
+    int seen[27], count = 0;
+    for (int z = cz - 1; z <= cz + 1; ++z)
+      for (int y = cy - 1; y <= cy + 1; ++y)
+        for (int x = cx - 1; x <= cx + 1; ++x) {
+          int b = bucket(x, y, z);
+          bool visited = false;
+          for (int s = 0; s < count; ++s) visited |= seen[s] == b;
+          if (visited) continue;  // two cubes, one bucket
+          seen[count++] = b;
+          for (int k = bucketStart[b]; k < bucketStart[b + 1]; ++k) f(order[k]);
+        }
+  }
+
+ private:
+  unsigned mask = 63;
+  std::vector<int> cursor;
+
+  int cell(float x) const { return (int)std::floor(x / cellSize); }
+
+  int bucket(int x, int y, int z) const {
+    // 21 bits per axis, then the splitmix64 finalizer to spread them out
+    uint64_t h = (uint64_t)(x & 0x1fffff) | (uint64_t)(y & 0x1fffff) << 21 |
+                 (uint64_t)(z & 0x1fffff) << 42;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return (int)(h & mask);
+  }
+};